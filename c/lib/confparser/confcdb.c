@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "iniparser.h"
+#include "confcdb.h"
+#include "scdb_make.h"
+
+#define CONF_KEY_LEN	1024
+
+/*
+ * stat of the INI a cdb was made from, INI keys cannot contain a 0 byte
+ */
+#define CONF_CDB_SOURCE		"\0source"
+#define CONF_CDB_SOURCE_LEN	7
+
+static int
+conf_source(const char *conf_name, char *buf, int size)
+{
+	struct stat st;
+
+	if (stat(conf_name, &st) == -1)
+		return (-1);
+
+	return snprintf(buf, size, "%lu %lu %lld %ld %ld",
+			(unsigned long)st.st_dev, (unsigned long)st.st_ino,
+			(long long)st.st_size,
+			(long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+}
+
+/*
+ * Compile conf_name into cdb_name, replaced atomically
+ * return the number of keys, -1 on error
+ */
+int
+compile_conf_file(const char *conf_name, const char *cdb_name)
+{
+	dictionary *conf;
+	struct scdb_make m;
+	char tmp[1024];
+	char src[128];
+	int srclen;
+	int fd;
+	int i, n = 0;
+
+	/* before parsing: a change made meanwhile makes the cdb stale */
+	srclen = conf_source(conf_name, src, sizeof(src));
+	if (srclen < 0)
+		return (-1);
+
+	conf = iniparser_load(conf_name);
+	if (conf == NULL)
+		return (-1);
+
+	/* one temp file per process, workers may compile at the same time */
+	snprintf(tmp, sizeof(tmp), "%s.tmp.%d", cdb_name, (int)getpid());
+	fd = open(tmp, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+	if (fd == -1) {
+		iniparser_freedict(conf);
+		return (-1);
+	}
+	if (scdb_make_start(&m, fd) == -1)
+		goto FAIL;
+
+	for (i = 0; i < conf->used; i++) {
+		if (conf->key[i] == NULL)
+			continue;
+		/* sections have no value, other values keep their '\0' */
+		if (scdb_make_add(&m, conf->key[i], strlen(conf->key[i]),
+				conf->val[i] ? conf->val[i] : "",
+				conf->val[i] ? strlen(conf->val[i]) + 1 : 0) == -1)
+			goto FAIL;
+		n++;
+	}
+	if (scdb_make_add(&m, CONF_CDB_SOURCE, CONF_CDB_SOURCE_LEN, src, srclen) == -1)
+		goto FAIL;
+
+	if (scdb_make_finish(&m) == -1 || fsync(fd) == -1)
+		goto FAIL;
+	if (rename(tmp, cdb_name) == -1)
+		goto FAIL;
+
+	close(fd);
+	iniparser_freedict(conf);
+	return n;
+
+FAIL:
+	close(fd);
+	unlink(tmp);
+	iniparser_freedict(conf);
+	return (-1);
+}
+
+/*
+ * return 1 if cdb_name was compiled from conf_name as it is now,
+ * 0 if it is missing or stale, -1 if conf_name cannot be read
+ */
+int
+conf_cdb_fresh(const char *conf_name, const char *cdb_name)
+{
+	struct scdb c;
+	char src[128];
+	char *data;
+	unsigned int dlen;
+	int srclen;
+	int fresh;
+
+	srclen = conf_source(conf_name, src, sizeof(src));
+	if (srclen < 0)
+		return (-1);
+	if (scdb_open(&c, (char *)cdb_name) == -1)
+		return 0;
+
+	fresh = scdb_lookup(&c, CONF_CDB_SOURCE, CONF_CDB_SOURCE_LEN, &data, &dlen) == 1
+		&& dlen == (unsigned int)srclen && memcmp(data, src, dlen) == 0;
+	scdb_close(&c);
+
+	return fresh;
+}
+
+CONF_CDB *
+open_conf_cdb(const char *cdb_name)
+{
+	CONF_CDB *cdb;
+
+	cdb = (CONF_CDB *)malloc(sizeof(CONF_CDB));
+	if (cdb == NULL)
+		return NULL;
+	if (scdb_open(cdb, (char *)cdb_name) == -1) {
+		free(cdb);
+		return NULL;
+	}
+
+	return cdb;
+}
+
+/*
+ * Value of a "section:key", in the shared map: valid until
+ * close_conf_cdb(), do not modify. NULL if not found or a section.
+ */
+char *
+conf_cdb_getstr(CONF_CDB *cdb, const char *key)
+{
+	char buf[CONF_KEY_LEN + 1];
+	char *data;
+	unsigned int dlen;
+	int i;
+
+	if (cdb == NULL || key == NULL)
+		return NULL;
+
+	for (i = 0; key[i] && i < CONF_KEY_LEN; i++)
+		buf[i] = (char)tolower((unsigned char)key[i]);
+	buf[i] = 0;
+
+	if (scdb_lookup(cdb, buf, i, &data, &dlen) != 1 || dlen == 0)
+		return NULL;
+
+	return data;
+}
+
+int
+parse_conf_cdb(CONF_CDB *cdb,
+				const char *mod_name,
+				CONF_INT_CONFIG cic[],
+				CONF_STR_CONFIG csc[])
+{
+	char buf[CONF_ITEM_LEN + 1];
+	char *s;
+	int i;
+	const CONF_INT_CONFIG *cicp;
+	const CONF_STR_CONFIG *cscp;
+
+	if (cdb == NULL || mod_name == NULL)
+		return (-1);
+
+	/* Get the int configure */
+	for (cicp = cic;
+		(cicp != NULL) && (cicp->config_name != 0);
+		cicp++) {
+		snprintf(buf, CONF_ITEM_LEN, "%s:%s", mod_name, cicp->config_name);
+		s = conf_cdb_getstr(cdb, buf);
+		i = s ? (int)strtol(s, NULL, 0) : -1;
+		if (i != -1)
+			*(cicp->var) = i;
+	}
+
+	/* Get the string configure */
+	for (cscp = csc;
+		(cscp != NULL) && (cscp->config_name != 0);
+		cscp++) {
+		snprintf(buf, CONF_ITEM_LEN, "%s:%s", mod_name, cscp->config_name);
+		s = conf_cdb_getstr(cdb, buf);
+		if (s)
+			strlcpy(cscp->var, s, CONF_ITEM_LEN + 1);
+	}
+
+	return (0);
+}
+
+void
+close_conf_cdb(CONF_CDB *cdb)
+{
+	if (cdb == NULL)
+		return;
+	scdb_close(cdb);
+	free(cdb);
+}
+
+/*
+ * load_conf() through a cdb: cdb_name is (re)compiled from conf_name
+ * when it is missing or stale, then the config is bound from its map
+ */
+int
+load_conf_cdb(const char *conf_name, const char *cdb_name, const char *mod_name,
+				CONF_INT_CONFIG cic[], CONF_STR_CONFIG csc[])
+{
+	CONF_CDB *cdb;
+
+	if (conf_cdb_fresh(conf_name, cdb_name) == 0
+		&& compile_conf_file(conf_name, cdb_name) == -1)
+		return (-1);
+
+	cdb = open_conf_cdb(cdb_name);
+	if (cdb == NULL)
+		return (-1);
+
+	parse_conf_cdb(cdb, mod_name, cic, csc);
+	close_conf_cdb(cdb);
+
+	return (0);
+}
@@ -0,0 +1,41 @@
+/*
+ * INI configs compiled into a cdb (../scdb), for many processes reading
+ * the same config.
+ *
+ * compile_conf_file() parses the INI once and writes every "section:key"
+ * (lowercased, as iniparser stores it) with its 0-terminated value. The
+ * readers mmap the cdb, so all workers share the same page-cache pages
+ * and nothing is parsed at startup.
+ *
+ * Build:
+ *  make -f linux.mk
+ *  gcc -o worker worker.c libconfcdb.a libconfparser.a ../scdb/libscdb.a -lz -lpthread
+ *
+ * Usage:
+ *  // compiles conf.ini into conf.cdb first if the cdb is missing or
+ *  // was made from another version of conf.ini
+ *  load_conf_cdb("conf.ini", "conf.cdb", "child", cic, csc);
+ *
+ *  // or keep it open and read values straight from the map
+ *  CONF_CDB *cdb = open_conf_cdb("conf.cdb");
+ *  char *port = conf_cdb_getstr(cdb, "child:mc_port");
+ *  close_conf_cdb(cdb);
+ */
+
+#ifndef _CSF_CONF_CDB_H
+#define _CSF_CONF_CDB_H
+
+#include "confparser.h"
+#include "scdb.h"
+
+typedef struct scdb CONF_CDB;
+
+int compile_conf_file(const char *conf_name, const char *cdb_name);
+int conf_cdb_fresh(const char *conf_name, const char *cdb_name);
+CONF_CDB *open_conf_cdb(const char *cdb_name);
+char *conf_cdb_getstr(CONF_CDB *, const char *key);
+int parse_conf_cdb(CONF_CDB *, const char *, CONF_INT_CONFIG[], CONF_STR_CONFIG[]);
+void close_conf_cdb(CONF_CDB *);
+int load_conf_cdb(const char *, const char *, const char *, CONF_INT_CONFIG[], CONF_STR_CONFIG[]);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Worker startup: load_conf() (parse the INI into a dictionary) against
+ * load_conf_cdb() (bind from the compiled cdb) for one module of a
+ * generated config, repeated as many times as there are workers.
+ *
+ * Build:
+ *  make -f linux.mk confcdb_bench
+ *
+ * Exec:
+ *  ./confcdb_bench [sections] [workers]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "confcdb.h"
+
+#define KEYS_PER_SEC	20
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int gen_ini(const char *fn, int sections)
+{
+	FILE *fp;
+	int i, j;
+
+	fp = fopen(fn, "w");
+	if (fp == NULL)
+		return -1;
+	for (i = 0; i < sections; i++) {
+		fprintf(fp, "[mod%d]\n", i);
+		for (j = 0; j < KEYS_PER_SEC / 2; j++) {
+			fprintf(fp, "int%d = %d\n", j, i + j);
+			fprintf(fp, "str%d = \"/var/lib/mod%d/file%d\" ; comment\n", j, i, j);
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *ini = "confcdb_bench.ini";
+	const char *cdb = "confcdb_bench.cdb";
+	int sections = argc > 1 ? atoi(argv[1]) : 10000;
+	int workers = argc > 2 ? atoi(argv[2]) : 100;
+	char names[KEYS_PER_SEC / 2][2][16];
+	char strs[KEYS_PER_SEC / 2][CONF_ITEM_LEN + 1];
+	int ints[KEYS_PER_SEC / 2];
+	CONF_INT_CONFIG cic[KEYS_PER_SEC / 2 + 1];
+	CONF_STR_CONFIG csc[KEYS_PER_SEC / 2 + 1];
+	double t0, t1, t2, t3;
+	int i;
+
+	for (i = 0; i < KEYS_PER_SEC / 2; i++) {
+		snprintf(names[i][0], sizeof(names[i][0]), "int%d", i);
+		snprintf(names[i][1], sizeof(names[i][1]), "str%d", i);
+		cic[i].config_name = names[i][0];
+		cic[i].var = &ints[i];
+		csc[i].config_name = names[i][1];
+		csc[i].var = strs[i];
+	}
+	memset(&cic[i], 0, sizeof(cic[i]));
+	memset(&csc[i], 0, sizeof(csc[i]));
+
+	if (gen_ini(ini, sections) != 0)
+		return 1;
+	unlink(cdb);
+
+	t0 = now_sec();
+	for (i = 0; i < workers; i++) {
+		if (load_conf((char *)ini, "mod7", cic, csc) != 0)
+			return 1;
+	}
+	t1 = now_sec();
+	if (compile_conf_file(ini, cdb) == -1)
+		return 1;
+	t2 = now_sec();
+	for (i = 0; i < workers; i++) {
+		ints[0] = -1;
+		if (load_conf_cdb(ini, cdb, "mod7", cic, csc) != 0 || ints[0] != 7)
+			return 1;
+	}
+	t3 = now_sec();
+	unlink(ini);
+	unlink(cdb);
+
+	printf("%d sections, %d keys, %d workers\n", sections, sections * KEYS_PER_SEC, workers);
+	printf("load_conf      %.3f ms/worker\n", (t1 - t0) * 1000 / workers);
+	printf("compile        %.3f ms once\n", (t2 - t1) * 1000);
+	printf("load_conf_cdb  %.3f ms/worker\n", (t3 - t2) * 1000 / workers);
+	return 0;
+}
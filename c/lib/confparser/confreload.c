@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "iniparser.h"
+#include "confreload.h"
+
+/*
+ * Read fd to the end into a private buffer. The watcher reloads on in-place
+ * writes, and a mapping would fault if the file were truncated meanwhile.
+ * return the buffer, NULL on error
+ */
+static char *
+conf_read(int fd, off_t hint, int *len)
+{
+	char *ini, *tmp;
+	ssize_t r;
+	int size;
+
+	/* one byte past the stat size, so a single read reaches EOF */
+	size = (int)hint + 1;
+	ini = (char *)malloc(size);
+	*len = 0;
+	while (ini != NULL) {
+		if (*len == size) {
+			if (size > INT_MAX / 2)
+				break;
+			size *= 2;
+			tmp = (char *)realloc(ini, size);
+			if (tmp == NULL)
+				break;
+			ini = tmp;
+		}
+		r = read(fd, ini + *len, size - *len);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r == 0)
+			return ini;
+		if (r == -1)
+			break;
+		*len += (int)r;
+	}
+	free(ini);
+	return NULL;
+}
+
+static CONF_SNAPSHOT *
+snap_load(const char *conf_name)
+{
+	CONF_SNAPSHOT *s;
+	struct stat st;
+	char *ini;
+	int len;
+	int fd;
+
+	fd = open(conf_name, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	/* stat first: a change made while parsing shows up as a new stat */
+	if (fstat(fd, &st) == -1 || st.st_size >= INT_MAX) {
+		close(fd);
+		return NULL;
+	}
+	ini = conf_read(fd, st.st_size, &len);
+	close(fd);
+	if (ini == NULL)
+		return NULL;
+
+	s = (CONF_SNAPSHOT *)calloc(1, sizeof(CONF_SNAPSHOT));
+	if (s == NULL) {
+		free(ini);
+		return NULL;
+	}
+
+	s->conf = iniparser_load_mem(ini, len);
+	free(ini);
+	if (s->conf == NULL) {
+		free(s);
+		return NULL;
+	}
+	s->refs = 1;
+	s->dev = st.st_dev;
+	s->ino = st.st_ino;
+	s->size = st.st_size;
+	s->mtime = st.st_mtim;
+
+	return s;
+}
+
+/*
+ * Wait until the readers that may have loaded the old pointer have taken
+ * their reference: gen is flipped twice and each old counter drained.
+ * Readers only stay counted for a load and an increment.
+ */
+static void
+synchronize(CONF_RELOAD *r)
+{
+	unsigned long gen;
+	int k;
+
+	for (k = 0; k < 2; k++) {
+		gen = __atomic_load_n(&r->gen, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&r->gen, gen + 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&r->readers[gen & 1].n, __ATOMIC_SEQ_CST))
+			sched_yield();
+	}
+}
+
+/*
+ * return 0 on success, -1 if conf_name cannot be loaded
+ */
+int
+conf_reload_open(CONF_RELOAD *r, const char *conf_name)
+{
+	memset(r, 0, sizeof(CONF_RELOAD));
+	snprintf(r->conf_name, sizeof(r->conf_name), "%s", conf_name);
+	r->inotify = -1;
+	r->wake[0] = r->wake[1] = -1;
+
+	pthread_mutex_init(&r->lock, NULL);
+
+	r->cur = snap_load(r->conf_name);
+	if (r->cur == NULL) {
+		pthread_mutex_destroy(&r->lock);
+		return (-1);
+	}
+	r->cur->version = 1;
+
+	return (0);
+}
+
+/*
+ * Pin the current snapshot, no lock taken. It stays valid, whatever
+ * reloads happen meanwhile, until conf_snapshot_release().
+ */
+CONF_SNAPSHOT *
+conf_snapshot_acquire(CONF_RELOAD *r)
+{
+	CONF_SNAPSHOT *s;
+	int i;
+
+	i = __atomic_load_n(&r->gen, __ATOMIC_SEQ_CST) & 1;
+	__atomic_fetch_add(&r->readers[i].n, 1, __ATOMIC_SEQ_CST);
+	s = __atomic_load_n(&r->cur, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&s->refs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&r->readers[i].n, 1, __ATOMIC_SEQ_CST);
+
+	return s;
+}
+
+void
+conf_snapshot_release(CONF_SNAPSHOT *s)
+{
+	if (s == NULL)
+		return;
+	if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		iniparser_freedict(s->conf);
+		free(s);
+	}
+}
+
+/*
+ * Reload conf_name if it changed (dev, inode, size or mtime)
+ * return 1 if a new snapshot was published, 0 if unchanged,
+ * -1 if it cannot be loaded (the current snapshot stays)
+ */
+int
+conf_reload_check(CONF_RELOAD *r)
+{
+	CONF_SNAPSHOT *s, *old;
+	struct stat st;
+
+	if (stat(r->conf_name, &st) == -1)
+		return (-1);
+
+	pthread_mutex_lock(&r->lock);
+
+	s = r->cur;
+	if (s->dev == st.st_dev && s->ino == st.st_ino && s->size == st.st_size
+		&& s->mtime.tv_sec == st.st_mtim.tv_sec
+		&& s->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+		pthread_mutex_unlock(&r->lock);
+		return (0);
+	}
+
+	s = snap_load(r->conf_name);
+	if (s == NULL) {
+		pthread_mutex_unlock(&r->lock);
+		return (-1);
+	}
+	s->version = r->cur->version + 1;
+
+	old = __atomic_exchange_n(&r->cur, s, __ATOMIC_SEQ_CST);
+	synchronize(r);
+	conf_snapshot_release(old);
+
+	pthread_mutex_unlock(&r->lock);
+
+	return (1);
+}
+
+static void *
+watch_loop(void *arg)
+{
+	CONF_RELOAD *r = (CONF_RELOAD *)arg;
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct pollfd pfd[2];
+	const char *base;
+	ssize_t n;
+	char *p;
+	int changed;
+
+	base = strrchr(r->conf_name, '/');
+	base = base ? base + 1 : r->conf_name;
+
+	pfd[0].fd = r->inotify;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = r->wake[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (pfd[1].revents)
+			break;
+
+		changed = 0;
+		while ((n = read(r->inotify, buf, sizeof(buf))) > 0) {
+			for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+				ev = (const struct inotify_event *)p;
+				/* dropped events may have hidden a change: check the stat */
+				if (ev->mask & IN_Q_OVERFLOW)
+					changed = 1;
+				else if (ev->len && strcmp(ev->name, base) == 0)
+					changed = 1;
+			}
+		}
+		if (changed)
+			conf_reload_check(r);
+	}
+
+	return NULL;
+}
+
+/*
+ * Start the watcher thread
+ * return 0 on success, -1 on error
+ */
+int
+conf_reload_watch(CONF_RELOAD *r)
+{
+	char dir[1024];
+	char *p;
+
+	if (r->watching)
+		return (0);
+
+	snprintf(dir, sizeof(dir), "%s", r->conf_name);
+	p = strrchr(dir, '/');
+	if (p == NULL)
+		snprintf(dir, sizeof(dir), ".");
+	else if (p == dir)
+		p[1] = 0;
+	else
+		*p = 0;
+
+	r->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (r->inotify == -1)
+		return (-1);
+	/* the directory: editors and deploy tools often rename() over the file */
+	if (inotify_add_watch(r->inotify, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1
+		|| pipe(r->wake) == -1)
+		goto FAIL;
+
+	r->watching = 1;
+	if (pthread_create(&r->watcher, NULL, watch_loop, r) != 0) {
+		r->watching = 0;
+		goto FAIL;
+	}
+
+	return (0);
+
+FAIL:
+	close(r->inotify);
+	r->inotify = -1;
+	if (r->wake[0] != -1) {
+		close(r->wake[0]);
+		close(r->wake[1]);
+		r->wake[0] = r->wake[1] = -1;
+	}
+	return (-1);
+}
+
+/*
+ * Stop the watcher and drop the current snapshot, snapshots still pinned
+ * are freed by their last conf_snapshot_release()
+ */
+void
+conf_reload_close(CONF_RELOAD *r)
+{
+	if (r->watching) {
+		while (write(r->wake[1], "", 1) == -1 && errno == EINTR)
+			;
+		pthread_join(r->watcher, NULL);
+		r->watching = 0;
+		close(r->inotify);
+		close(r->wake[0]);
+		close(r->wake[1]);
+		r->inotify = -1;
+		r->wake[0] = r->wake[1] = -1;
+	}
+
+	if (r->cur) {
+		conf_snapshot_release(r->cur);
+		r->cur = NULL;
+	}
+
+	pthread_mutex_destroy(&r->lock);
+}
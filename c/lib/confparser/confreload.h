@@ -0,0 +1,71 @@
+/*
+ * Hot-reloadable config: versioned snapshots of a parsed INI.
+ *
+ * A watcher thread (inotify on the directory of the conf file, so edits
+ * in place and rename() over it are both seen) parses the new file into a
+ * new snapshot and publishes it with an atomic pointer swap. A file that
+ * fails to parse is ignored and the old snapshot stays current.
+ *
+ * Readers pin a snapshot without locking: conf_snapshot_acquire() takes a
+ * reference under a two-counter epoch that only guards the pointer load,
+ * so the writer never waits for readers holding a snapshot, and the old
+ * dictionary is freed by whoever drops its last reference.
+ *
+ * Usage:
+ *  CONF_RELOAD r;
+ *  conf_reload_open(&r, "server.ini");
+ *  conf_reload_watch(&r);
+ *
+ *  // any thread
+ *  CONF_SNAPSHOT *s = conf_snapshot_acquire(&r);
+ *  parse_conf_file(s->conf, "child", cic, csc);    // or iniparser_getstring(s->conf, ...)
+ *  conf_snapshot_release(s);
+ *
+ *  conf_reload_close(&r);
+ */
+
+#ifndef _CSF_CONF_RELOAD_H
+#define _CSF_CONF_RELOAD_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "confparser.h"
+
+typedef struct conf_snapshot {
+	dictionary		*conf;
+	unsigned long	version;	/* 1 for the first load, +1 per reload */
+	int				refs;
+	dev_t			dev;
+	ino_t			ino;
+	off_t			size;
+	struct timespec	mtime;
+} CONF_SNAPSHOT;
+
+/* readers inside conf_snapshot_acquire(), one cache line each */
+struct conf_readers {
+	unsigned long	n;
+	char			pad[64 - sizeof(unsigned long)];
+};
+
+typedef struct conf_reload {
+	char				conf_name[1024];
+	CONF_SNAPSHOT		*cur;		/* atomic */
+	unsigned long		gen;		/* new readers count in readers[gen & 1] */
+	struct conf_readers	readers[2];
+	pthread_mutex_t		lock;		/* serializes reloads */
+	pthread_t			watcher;
+	int					watching;
+	int					inotify;	/* watches the directory of conf_name */
+	int					wake[2];	/* pipe, stops the watcher */
+} CONF_RELOAD;
+
+int conf_reload_open(CONF_RELOAD *r, const char *conf_name);
+CONF_SNAPSHOT *conf_snapshot_acquire(CONF_RELOAD *r);
+void conf_snapshot_release(CONF_SNAPSHOT *s);
+int conf_reload_check(CONF_RELOAD *r);
+int conf_reload_watch(CONF_RELOAD *r);
+void conf_reload_close(CONF_RELOAD *r);
+
+#endif
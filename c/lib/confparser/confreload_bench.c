@@ -0,0 +1,133 @@
+/*
+ * Readers looking up a key through conf_snapshot_acquire()/release()
+ * while the conf file is rewritten and the watcher thread reloads it:
+ * lookups per second and the slowest lookup (on a single CPU that is
+ * mostly the reader being preempted by the reload).
+ *
+ * Build:
+ *  make -f linux.mk confreload_bench
+ *
+ * Exec:
+ *  ./confreload_bench [readers] [rewrites] [keys]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "confreload.h"
+
+struct reader
+{
+	CONF_RELOAD *r;
+	pthread_t tid;
+	long lookups;
+	double slowest;
+};
+
+static int stop;
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* written next to fn and renamed over it, like a deploy would */
+static int gen_ini(const char *fn, int keys, int version)
+{
+	char tmp[256];
+	FILE *fp;
+	int i;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", fn);
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+		return -1;
+	fprintf(fp, "[main]\nversion = %d\n", version);
+	for (i = 0; i < keys; i++)
+		fprintf(fp, "key%d = value%d\n", i, i);
+	fclose(fp);
+	return rename(tmp, fn);
+}
+
+static void *read_loop(void *arg)
+{
+	struct reader *rd = arg;
+	CONF_SNAPSHOT *s;
+	double t0, t;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		t0 = now_sec();
+		s = conf_snapshot_acquire(rd->r);
+		if (iniparser_getstring(s->conf, "main:key1", NULL) == NULL)
+			abort();
+		conf_snapshot_release(s);
+		t = now_sec() - t0;
+		if (t > rd->slowest)
+			rd->slowest = t;
+		rd->lookups++;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	const char *fn = "confreload_bench.ini";
+	int nreaders = argc > 1 ? atoi(argv[1]) : 4;
+	int rewrites = argc > 2 ? atoi(argv[2]) : 20;
+	int keys = argc > 3 ? atoi(argv[3]) : 100000;
+	struct reader *rd;
+	CONF_RELOAD r;
+	CONF_SNAPSHOT *s;
+	double t0, t1, slowest = 0;
+	long lookups = 0;
+	int i, version;
+
+	if (gen_ini(fn, keys, 1) != 0 || conf_reload_open(&r, fn) != 0
+		|| conf_reload_watch(&r) != 0)
+		return 1;
+
+	rd = calloc(nreaders, sizeof(*rd));
+	t0 = now_sec();
+	for (i = 0; i < nreaders; i++) {
+		rd[i].r = &r;
+		pthread_create(&rd[i].tid, NULL, read_loop, &rd[i]);
+	}
+	for (i = 2; i <= rewrites + 1; i++) {
+		if (gen_ini(fn, keys, i) != 0)
+			return 1;
+		/* wait for the watcher to publish it */
+		do {
+			usleep(1000);
+			s = conf_snapshot_acquire(&r);
+			version = atoi(iniparser_getstring(s->conf, "main:version", "0"));
+			conf_snapshot_release(s);
+		} while (version != i);
+	}
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(rd[i].tid, NULL);
+		lookups += rd[i].lookups;
+		if (rd[i].slowest > slowest)
+			slowest = rd[i].slowest;
+	}
+	t1 = now_sec();
+
+	s = conf_snapshot_acquire(&r);
+	printf("%d readers, %d keys, %d reloads (version %lu) in %.3fs\n",
+		nreaders, keys, rewrites, s->version, t1 - t0);
+	printf("%.0f lookups/s, slowest lookup %.1f us\n",
+		lookups / (t1 - t0), slowest * 1e6);
+	conf_snapshot_release(s);
+
+	conf_reload_close(&r);
+	unlink(fn);
+	free(rd);
+	return 0;
+}
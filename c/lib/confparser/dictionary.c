@@ -35,6 +35,20 @@
 /** Invalid key token */
 #define DICT_INVALID_KEY    ((char*)-1)
 
+/** Hash table slot states, other values are entry numbers */
+#define DICT_EMPTY		-1
+#define DICT_DELETED	-2
+
+/** Minimal size of a dictionary_alloc() chunk */
+#define DICT_CHUNKSZ	(64*1024)
+
+/** A chunk of dictionary_alloc() space, the data follows the header */
+typedef struct _dict_chunk_ {
+	struct _dict_chunk_	*	next ;	/** Previous chunk */
+	int						size ;	/** Data size */
+	int						used ;	/** Data handed out */
+} dict_chunk ;
+
 /*---------------------------------------------------------------------------
   							Private functions
  ---------------------------------------------------------------------------*/
@@ -76,6 +90,122 @@ static char * xstrdup(char * s)
     return t ;
 }
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Free a key or value unless it comes from dictionary_alloc()
+  @param    d       dictionary object.
+  @param    s       String to free, may be NULL.
+  @return   void
+
+  Chunks double in size, so there are only a few of them to look at.
+ */
+/*--------------------------------------------------------------------------*/
+static void dict_free(dictionary * d, char * s)
+{
+	dict_chunk	*	c ;
+	char		*	data ;
+
+	if (s==NULL)
+		return ;
+	for (c=(dict_chunk *)d->arena ; c!=NULL ; c=c->next) {
+		data = (char *)(c+1) ;
+		if (s>=data && s<data+c->size)
+			return ;
+	}
+	free(s);
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Find the hash table slot of a key
+  @param    d       dictionary object to search.
+  @param    key     Key to look for.
+  @param    hash    dictionary_hash(key)
+  @return   Slot number, or -1 if the key is not in the dictionary
+
+  Linear probing from hash & (tsize-1). Tombstones are skipped, an empty
+  slot ends the search.
+ */
+/*--------------------------------------------------------------------------*/
+static int dict_find(dictionary * d, char * key, unsigned hash)
+{
+	unsigned	mask ;
+	unsigned	i ;
+	int			e ;
+
+	mask = d->tsize - 1 ;
+	for (i=hash & mask ; (e=d->table[i])!=DICT_EMPTY ; i=(i+1) & mask) {
+		if (e>=0 && d->hash[e]==hash && !strcmp(key, d->key[e]))
+			return (int)i ;
+	}
+	return -1 ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Rebuild the hash table
+  @param    d       dictionary object to modify.
+  @param    tsize   New table size, a power of 2 larger than d->n
+  @return   int     0 if Ok, -1 if out of memory
+
+  Drops all tombstones.
+ */
+/*--------------------------------------------------------------------------*/
+static int dict_rehash(dictionary * d, int tsize)
+{
+	int		*	table ;
+	unsigned	i ;
+	int			e ;
+
+	table = (int *)malloc(tsize * sizeof(int));
+	if (table==NULL)
+		return -1 ;
+	memset(table, 0xff, tsize * sizeof(int));	/* DICT_EMPTY */
+	for (e=0 ; e<d->used ; e++) {
+		if (d->key[e]==NULL)
+			continue ;
+		for (i=d->hash[e] & (tsize-1) ; table[i]!=DICT_EMPTY ; i=(i+1) & (tsize-1))
+			;
+		table[i] = e ;
+	}
+	free(d->table);
+	d->table = table ;
+	d->tsize = tsize ;
+	d->tused = d->n ;
+	return 0 ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Close the holes left by deleted entries
+  @param    d       dictionary object to modify.
+  @return   int     0 if Ok, -1 if out of memory
+
+  Entries keep their relative order, the table is rebuilt since entry
+  numbers change.
+ */
+/*--------------------------------------------------------------------------*/
+static int dict_compact(dictionary * d)
+{
+	int		i, j ;
+
+	for (i=0, j=0 ; i<d->used ; i++) {
+		if (d->key[i]==NULL)
+			continue ;
+		d->key[j]  = d->key[i] ;
+		d->val[j]  = d->val[i] ;
+		d->hash[j] = d->hash[i] ;
+		j++ ;
+	}
+	for (i=j ; i<d->used ; i++) {
+		d->key[i]  = NULL ;
+		d->val[i]  = NULL ;
+		d->hash[i] = 0 ;
+	}
+	d->used = j ;
+	return dict_rehash(d, d->tsize);
+}
+
 /*---------------------------------------------------------------------------
   							Function codes
  ---------------------------------------------------------------------------*/
@@ -134,6 +264,15 @@ dictionary * dictionary_new(int size)
 	d->val  = (char **)calloc(size, sizeof(char*));
 	d->key  = (char **)calloc(size, sizeof(char*));
 	d->hash = (unsigned int *)calloc(size, sizeof(unsigned));
+	/* At most half full: table size is a power of 2 >= 2*size */
+	for (d->tsize=1 ; d->tsize<2*size ; d->tsize*=2)
+		;
+	d->table = (int *)malloc(d->tsize * sizeof(int));
+	if (d->val==NULL || d->key==NULL || d->hash==NULL || d->table==NULL) {
+		dictionary_del(d);
+		return NULL ;
+	}
+	memset(d->table, 0xff, d->tsize * sizeof(int));	/* DICT_EMPTY */
 	return d ;
 }
 
@@ -148,18 +287,22 @@ dictionary * dictionary_new(int size)
 /*--------------------------------------------------------------------------*/
 void dictionary_del(dictionary * d)
 {
-	int		i ;
+	int				i ;
+	dict_chunk	*	c ;
 
 	if (d==NULL) return ;
-	for (i=0 ; i<d->size ; i++) {
-		if (d->key[i]!=NULL)
-			free(d->key[i]);
-		if (d->val[i]!=NULL)
-			free(d->val[i]);
+	for (i=0 ; i<d->used ; i++) {
+		dict_free(d, d->key[i]);
+		dict_free(d, d->val[i]);
+	}
+	while ((c=(dict_chunk *)d->arena)!=NULL) {
+		d->arena = c->next ;
+		free(c);
 	}
 	free(d->val);
 	free(d->key);
 	free(d->hash);
+	free(d->table);
 	free(d);
 	return ;
 }
@@ -180,22 +323,85 @@ void dictionary_del(dictionary * d)
 /*--------------------------------------------------------------------------*/
 char * dictionary_get(dictionary * d, char * key, char * def)
 {
-	unsigned	hash ;
 	int			i ;
 
-	hash = dictionary_hash(key);
-	for (i=0 ; i<d->size ; i++) {
-        if (d->key[i]==NULL)
-            continue ;
-        /* Compare hash */
-		if (hash==d->hash[i]) {
-            /* Compare string, to avoid hash collisions */
-            if (!strcmp(key, d->key[i])) {
-				return d->val[i] ;
-			}
-		}
+	i = dict_find(d, key, dictionary_hash(key));
+	if (i<0)
+		return def ;
+	return d->val[d->table[i]] ;
+}
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Set a value in a dictionary, copying key and val or not
+  @param    d       dictionary object to modify.
+  @param    key     Key to modify or add.
+  @param    val     Value to add.
+  @param    copy    Non-zero to store copies made with xstrdup()
+  @return   int     0 if Ok, -1 otherwise
+ */
+/*--------------------------------------------------------------------------*/
+static int dict_set(dictionary * d, char * key, char * val, int copy)
+{
+	int			i, e ;
+	unsigned	hash ;
+	unsigned	mask ;
+
+	if (d==NULL || key==NULL) return -1 ;
+	
+	/* Compute hash for this key */
+	hash = dictionary_hash(key) ;
+	/* Find if value is already in dictionary */
+	i = dict_find(d, key, hash);
+	if (i>=0) {
+		/* Found a value: modify and return */
+		e = d->table[i] ;
+		dict_free(d, d->val[e]);
+		d->val[e] = (val && copy) ? xstrdup(val) : val ;
+		return 0 ;
+	}
+	/* Add a new value at the end */
+	if (d->used==d->size && d->n<d->size/2) {
+		/* Mostly deleted entries: close the holes */
+		if (dict_compact(d)!=0)
+			return -1 ;
 	}
-	return def ;
+	/* See if dictionary needs to grow */
+	if (d->used==d->size) {
+
+		/* Reached maximum size: reallocate dictionary */
+		d->val  = (char **)mem_double(d->val,  d->size * sizeof(char*)) ;
+		d->key  = (char **)mem_double(d->key,  d->size * sizeof(char*)) ;
+		d->hash = (unsigned int *)mem_double(d->hash, d->size * sizeof(unsigned)) ;
+        if ((d->val==NULL) || (d->key==NULL) || (d->hash==NULL)) {
+            /* Cannot grow dictionary */
+            return -1 ;
+        }
+		/* Double size */
+		d->size *= 2 ;
+		if (dict_rehash(d, d->tsize*2)!=0)
+			return -1 ;
+	} else if (d->tused>=d->tsize/4*3) {
+		/* Too many tombstones */
+		if (dict_rehash(d, d->tsize)!=0)
+			return -1 ;
+	}
+
+	/* Copy key */
+	e = d->used ;
+	d->key[e]  = copy ? xstrdup(key) : key ;
+    d->val[e]  = (val && copy) ? xstrdup(val) : val ;
+	d->hash[e] = hash;
+	d->used ++ ;
+	d->n ++ ;
+	/* First free slot, a tombstone can be reused */
+	mask = d->tsize - 1 ;
+	for (i=hash & mask ; d->table[i]>=0 ; i=(i+1) & mask)
+		;
+	if (d->table[i]==DICT_EMPTY)
+		d->tused ++ ;
+	d->table[i] = e ;
+	return 0 ;
 }
 
 /*-------------------------------------------------------------------------*/
@@ -226,61 +432,87 @@ char * dictionary_get(dictionary * d, char * key, char * def)
 /*--------------------------------------------------------------------------*/
 int dictionary_set(dictionary * d, char * key, char * val)
 {
-	int			i ;
-	unsigned	hash ;
+	return dict_set(d, key, val, 1);
+}
 
-	if (d==NULL || key==NULL) return -1 ;
-	
-	/* Compute hash for this key */
-	hash = dictionary_hash(key) ;
-	/* Find if value is already in dictionary */
-	if (d->n>0) {
-		for (i=0 ; i<d->size ; i++) {
-            if (d->key[i]==NULL)
-                continue ;
-			if (hash==d->hash[i]) { /* Same hash value */
-				if (!strcmp(key, d->key[i])) {	 /* Same key */
-					/* Found a value: modify and return */
-					if (d->val[i]!=NULL)
-						free(d->val[i]);
-                    d->val[i] = val ? xstrdup(val) : NULL ;
-                    /* Value has been modified: return */
-					return 0 ;
-				}
-			}
-		}
-	}
-	/* Add a new value */
-	/* See if dictionary needs to grow */
-	if (d->n==d->size) {
+/*-------------------------------------------------------------------------*/
+/**
+  @brief	Allocate string space that lives as long as the dictionary.
+  @param	d		dictionary object.
+  @param	size	Number of bytes.
+  @return	Pointer to the space, NULL if out of memory.
 
-		/* Reached maximum size: reallocate dictionary */
-		d->val  = (char **)mem_double(d->val,  d->size * sizeof(char*)) ;
-		d->key  = (char **)mem_double(d->key,  d->size * sizeof(char*)) ;
-		d->hash = (unsigned int *)mem_double(d->hash, d->size * sizeof(unsigned)) ;
-        if ((d->val==NULL) || (d->key==NULL) || (d->hash==NULL)) {
-            /* Cannot grow dictionary */
-            return -1 ;
-        }
-		/* Double size */
-		d->size *= 2 ;
+  The space comes from chunks owned by the dictionary and is released all
+  at once by dictionary_del(). It cannot be freed on its own.
+ */
+/*--------------------------------------------------------------------------*/
+char * dictionary_alloc(dictionary * d, int size)
+{
+	dict_chunk	*	c ;
+	int				csize ;
+	char		*	p ;
+
+	c = (dict_chunk *)d->arena ;
+	if (c==NULL || c->size-c->used<size) {
+		/* New chunk, twice as large as the last one */
+		csize = c ? 2*c->size : DICT_CHUNKSZ ;
+		if (csize<size) csize = size ;
+		if (dictionary_reserve(d, csize)!=0)
+			return NULL ;
+		c = (dict_chunk *)d->arena ;
 	}
+	p = (char *)(c+1) + c->used ;
+	c->used += size ;
+	return p ;
+}
 
-    /* Insert key in the first empty slot */
-    for (i=0 ; i<d->size ; i++) {
-        if (d->key[i]==NULL) {
-            /* Add key here */
-            break ;
-        }
-    }
-	/* Copy key */
-	d->key[i]  = xstrdup(key);
-    d->val[i]  = val ? xstrdup(val) : NULL ;
-	d->hash[i] = hash;
-	d->n ++ ;
+/*-------------------------------------------------------------------------*/
+/**
+  @brief	Make room for dictionary_alloc() calls.
+  @param	d		dictionary object.
+  @param	size	Number of bytes the next calls will take together.
+  @return	int		0 if Ok, -1 if out of memory
+
+  Starts a chunk of at least size bytes unless the current one has that
+  much room left, so that a caller who knows how much it will need gets
+  it in one allocation.
+ */
+/*--------------------------------------------------------------------------*/
+int dictionary_reserve(dictionary * d, int size)
+{
+	dict_chunk	*	c ;
+
+	c = (dict_chunk *)d->arena ;
+	if (c!=NULL && c->size-c->used>=size)
+		return 0 ;
+	if (size<DICT_CHUNKSZ) size = DICT_CHUNKSZ ;
+	c = (dict_chunk *)malloc(sizeof(dict_chunk) + size);
+	if (c==NULL)
+		return -1 ;
+	c->next = (dict_chunk *)d->arena ;
+	c->size = size ;
+	c->used = 0 ;
+	d->arena = c ;
 	return 0 ;
 }
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief	Set a value in a dictionary without copying it.
+  @param	d		dictionary object to modify.
+  @param	key		Key to modify or add, from dictionary_alloc().
+  @param	val		Value to add, from dictionary_alloc(), or NULL.
+  @return	int		0 if Ok, anything else otherwise
+
+  Same as dictionary_set(), but key and val are stored as they are. Both
+  must have been returned by dictionary_alloc() on the same dictionary.
+ */
+/*--------------------------------------------------------------------------*/
+int dictionary_set_ref(dictionary * d, char * key, char * val)
+{
+	return dict_set(d, key, val, 0);
+}
+
 /*-------------------------------------------------------------------------*/
 /**
   @brief	Delete a key in a dictionary
@@ -294,38 +526,28 @@ int dictionary_set(dictionary * d, char * key, char * val)
 /*--------------------------------------------------------------------------*/
 void dictionary_unset(dictionary * d, char * key)
 {
-	unsigned	hash ;
-	int			i ;
+	int			i, e ;
 
 	if (key == NULL) {
 		return;
 	}
 
-	hash = dictionary_hash(key);
-	for (i=0 ; i<d->size ; i++) {
-        if (d->key[i]==NULL)
-            continue ;
-        /* Compare hash */
-		if (hash==d->hash[i]) {
-            /* Compare string, to avoid hash collisions */
-            if (!strcmp(key, d->key[i])) {
-                /* Found key */
-                break ;
-			}
-		}
-	}
-    if (i>=d->size)
+    i = dict_find(d, key, dictionary_hash(key));
+    if (i<0)
         /* Key not found */
         return ;
 
-    free(d->key[i]);
-    d->key[i] = NULL ;
-    if (d->val[i]!=NULL) {
-        free(d->val[i]);
-        d->val[i] = NULL ;
-    }
-    d->hash[i] = 0 ;
+    e = d->table[i] ;
+    d->table[i] = DICT_DELETED ;
+    dict_free(d, d->key[e]);
+    d->key[e] = NULL ;
+    dict_free(d, d->val[e]);
+    d->val[e] = NULL ;
+    d->hash[e] = 0 ;
     d->n -- ;
+    /* Deleted entries at the end are free again */
+    while (d->used>0 && d->key[d->used-1]==NULL)
+        d->used -- ;
     return ;
 }
 
@@ -350,7 +572,7 @@ void dictionary_dump(dictionary * d, FILE * out)
 		fprintf(out, "empty dictionary\n");
 		return ;
 	}
-	for (i=0 ; i<d->size ; i++) {
+	for (i=0 ; i<d->used ; i++) {
         if (d->key[i]) {
             fprintf(out, "%20s\t[%s]\n",
                     d->key[i],
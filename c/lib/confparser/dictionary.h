@@ -42,9 +42,10 @@
   @brief	Dictionary object
 
   This object contains a list of string/string associations. Each
-  association is identified by a unique string key. Looking up values
-  in the dictionary is speeded up by the use of a (hopefully collision-free)
-  hash function.
+  association is identified by a unique string key. Entries are stored in
+  key/val/hash in insertion order (deleted entries leave a NULL key), so
+  walking key[0..size-1] gives a stable order. Lookups go through an open
+  addressing hash table of entry numbers.
  */
 /*-------------------------------------------------------------------------*/
 typedef struct _dictionary_ {
@@ -53,6 +54,11 @@ typedef struct _dictionary_ {
 	char 		**	val ;	/** List of string values */
 	char 		**  key ;	/** List of string keys */
 	unsigned	 *	hash ;	/** List of hash values for keys */
+	int				used ;	/** Entries used, deleted ones included */
+	int			 *	table ;	/** Hash table of entry numbers */
+	int				tsize ;	/** Table size, a power of 2 */
+	int				tused ;	/** Table slots used, tombstones included */
+	void		 *	arena ;	/** Chunks handed out by dictionary_alloc() */
 } dictionary ;
 
 
@@ -143,6 +149,47 @@ char * dictionary_get(dictionary * d, char * key, char * def);
 /*--------------------------------------------------------------------------*/
 int dictionary_set(dictionary * vd, char * key, char * val);
 
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Allocate string space that lives as long as the dictionary.
+  @param    d       dictionary object.
+  @param    size    Number of bytes.
+  @return   Pointer to the space, NULL if out of memory.
+
+  The space comes from chunks owned by the dictionary and is released all
+  at once by dictionary_del(). It cannot be freed on its own.
+ */
+/*--------------------------------------------------------------------------*/
+char * dictionary_alloc(dictionary * d, int size);
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Make room for dictionary_alloc() calls.
+  @param    d       dictionary object.
+  @param    size    Number of bytes the next calls will take together.
+  @return   int     0 if Ok, -1 if out of memory
+
+  Starts a chunk of at least size bytes unless the current one has that
+  much room left, so that a caller who knows how much it will need gets
+  it in one allocation.
+ */
+/*--------------------------------------------------------------------------*/
+int dictionary_reserve(dictionary * d, int size);
+
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Set a value in a dictionary without copying it.
+  @param    d       dictionary object to modify.
+  @param    key     Key to modify or add, from dictionary_alloc().
+  @param    val     Value to add, from dictionary_alloc(), or NULL.
+  @return   int     0 if Ok, anything else otherwise
+
+  Same as dictionary_set(), but key and val are stored as they are. Both
+  must have been returned by dictionary_alloc() on the same dictionary.
+ */
+/*--------------------------------------------------------------------------*/
+int dictionary_set_ref(dictionary * d, char * key, char * val);
+
 /*-------------------------------------------------------------------------*/
 /**
   @brief    Delete a key in a dictionary
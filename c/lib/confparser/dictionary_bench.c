@@ -0,0 +1,152 @@
+/*
+ * dictionary / iniparser benchmark: iniparser_load() of a generated ini
+ * file and iniparser_getstring() of every key, at 1k, 100k and 1M keys.
+ * Also times iniparser_load_mem() of the same text and reports the heap
+ * held by the loaded dictionary.
+ *
+ * Build:
+ *  make -f linux.mk dictionary_bench
+ *
+ * Exec:
+ *  ./dictionary_bench [keys ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "iniparser.h"
+
+#define KEYS_PER_SEC	100
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* bytes in use on the heap, -1 if unknown */
+static long heap_used(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 mi = mallinfo2();
+
+	return (long)(mi.uordblks + mi.hblkhd);
+#else
+	return -1;
+#endif
+}
+
+static char *read_ini(const char *fn, int *len)
+{
+	FILE *fp;
+	char *buf;
+	long n;
+
+	fp = fopen(fn, "r");
+	if (fp == NULL)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	rewind(fp);
+	buf = malloc(n + 1);
+	if (buf != NULL && fread(buf, 1, n, fp) != (size_t)n) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	*len = (int)n;
+	return buf;
+}
+
+static int gen_ini(const char *fn, int keys)
+{
+	FILE *fp;
+	int i;
+
+	fp = fopen(fn, "w");
+	if (fp == NULL)
+		return -1;
+	for (i = 0; i < keys; i++) {
+		if (i % KEYS_PER_SEC == 0)
+			fprintf(fp, "\n[route%d]\n", i / KEYS_PER_SEC);
+		fprintf(fp, "user%d@example.com = smtp:[10.0.%d.%d]:25\n",
+				i, (i >> 8) & 255, i & 255);
+	}
+	fclose(fp);
+	return 0;
+}
+
+static int bench(int keys)
+{
+	const char *fn = "dictionary_bench.ini";
+	dictionary *d;
+	char key[128];
+	char *ini;
+	double t0, t1, t2, t3;
+	long heap;
+	int i, len, miss = 0;
+
+	if (gen_ini(fn, keys) != 0)
+		return -1;
+	ini = read_ini(fn, &len);
+	if (ini == NULL)
+		return -1;
+
+	t0 = now_sec();
+	d = iniparser_load_mem(ini, len);
+	t1 = now_sec();
+	free(ini);
+	if (d == NULL)
+		return -1;
+	iniparser_freedict(d);
+	printf("%8d keys: load_mem %.3fs, ", keys, t1 - t0);
+
+	heap = heap_used();
+	t0 = now_sec();
+	d = iniparser_load(fn);
+	t1 = now_sec();
+	heap = heap_used() - heap;
+	unlink(fn);
+	if (d == NULL)
+		return -1;
+
+	for (i = 0; i < keys; i++) {
+		snprintf(key, sizeof(key), "route%d:user%d@example.com", i / KEYS_PER_SEC, i);
+		if (iniparser_getstring(d, key, NULL) == NULL)
+			miss++;
+	}
+	t2 = now_sec();
+	iniparser_freedict(d);
+	t3 = now_sec();
+
+	printf("load %.3fs (%.0f keys/s), heap %.1f MB (%.0f B/key), "
+		"lookup %.3fs (%.0f lookups/s), free %.3fs%s\n",
+		t1 - t0, keys / (t1 - t0), heap / 1048576.0, (double)heap / keys,
+		t2 - t1, keys / (t2 - t1), t3 - t2, miss ? ", MISSING KEYS" : "");
+	return miss ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	int sizes[] = {1000, 100000, 1000000};
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			if (bench(atoi(argv[i])) != 0)
+				return 1;
+		return 0;
+	}
+	for (i = 0; i < 3; i++)
+		if (bench(sizes[i]) != 0)
+			return 1;
+	return 0;
+}
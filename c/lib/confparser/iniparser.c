@@ -15,6 +15,11 @@
 */
 /*---------------------------- Includes ------------------------------------*/
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "iniparser.h"
 
 /*---------------------------- Defines -------------------------------------*/
@@ -36,6 +41,14 @@ typedef enum _line_status_ {
     LINE_VALUE
 } line_status ;
 
+/**
+ * A piece of an input line, not 0-terminated (internal use only).
+ */
+typedef struct _ini_span_ {
+    const char * s ;
+    int          len ;
+} ini_span ;
+
 /*-------------------------------------------------------------------------*/
 /**
   @brief	Convert a string to lowercase.
@@ -65,34 +78,22 @@ static char * strlwc(char *buf, const char * s)
 
 /*-------------------------------------------------------------------------*/
 /**
-  @brief	Remove blanks at the beginning and the end of a string.
-  @param	s	String to parse.
-  @return	ptr to statically allocated string.
+  @brief	Remove blanks at the beginning and the end of a span.
+  @param	s	Span to parse, updated in place.
+  @return	void
 
-  This function returns a pointer to a statically allocated string,
-  which is identical to the input string, except that all blank
-  characters at the end and the beg. of the string have been removed.
-  Do not free or modify the returned string! Since the returned string
-  is statically allocated, it will be modified at each function call.
+  Moves s->s past the leading blanks and shortens s->len so that the
+  span ends before the trailing ones. Nothing is copied.
  */
 /*--------------------------------------------------------------------------*/
-static char * strstrip(char *buf, char * s)
+static void strnstrip(ini_span * s)
 {
-	char * last ;
-	
-    if (s==NULL) return NULL ;
-    
-	while (isspace((int)*s) && *s) s++;
-	memset(buf, 0, ASCIILINESZ+1);
-	strcpy(buf, s);
-	last = buf + strlen(buf);
-	while (last > buf) {
-		if (!isspace((int)*(last-1)))
-			break ;
-		last -- ;
+	while (s->len>0 && isspace((unsigned char)s->s[0])) {
+		s->s++ ;
+		s->len-- ;
 	}
-	*last = (char)0;
-	return (char*)buf;
+	while (s->len>0 && isspace((unsigned char)s->s[s->len-1]))
+		s->len-- ;
 }
 
 /*-------------------------------------------------------------------------*/
@@ -441,236 +442,250 @@ void iniparser_unset(dictionary * ini, char * entry)
 	char l[ASCIILINESZ+1];
     dictionary_unset(ini, strlwc(l, entry));
 }
-
 /*-------------------------------------------------------------------------*/
 /**
   @brief	Load a single line from an INI file
-  @param    input_line  Input line, may be concatenated multi-line input
-  @param    section     Output space to store section
-  @param    key         Output space to store key
-  @param    value       Output space to store value
+  @param    line        Input line, may be concatenated multi-line input
+  @param    len         Length of the line
+  @param    section     Output span of the section name
+  @param    key         Output span of the key
+  @param    value       Output span of the value
   @return   line_status value
+
+  The output spans point into the line, nothing is copied or lowercased.
+  A section line without a name ("[]") gives a NULL section span.
  */
 /*--------------------------------------------------------------------------*/
 static line_status iniparser_line(
-    char * input_line,
-    char * section,
-    char * key,
-    char * value)
-{   
-    line_status sta ;
-    char        line[ASCIILINESZ+1];
-	char        l[ASCIILINESZ+1];
-    int         len ;
-
-    strcpy(line, strstrip(l, input_line));
-    len = (int)strlen(line);
-
-    sta = LINE_UNPROCESSED ;
-    if (len<1) {
+    const char * line,
+    int          len,
+    ini_span   * section,
+    ini_span   * key,
+    ini_span   * value)
+{
+    ini_span     l ;
+    const char * p ;
+    int          i ;
+
+    l.s = line ;
+    l.len = len ;
+    strnstrip(&l);
+
+    if (l.len<1) {
         /* Empty line */
-        sta = LINE_EMPTY ;
-    } else if (line[0]=='#') {
+        return LINE_EMPTY ;
+    }
+    if (l.s[0]=='#') {
         /* Comment line */
-        sta = LINE_COMMENT ; 
-    } else if (line[0]=='[' && line[len-1]==']') {
-        /* Section name */
-        sscanf(line, "[%[^]]", section);
-        strcpy(section, strstrip(l, section));
-        strcpy(section, strlwc(l, section));
-        sta = LINE_SECTION ;
-    } else if (sscanf (line, "%[^=] = \"%[^\"]\"", key, value) == 2
-           ||  sscanf (line, "%[^=] = '%[^\']'",   key, value) == 2
-           ||  sscanf (line, "%[^=] = %[^;#]",     key, value) == 2) {
-        /* Usual key=value, with or without comments */
-        strcpy(key, strstrip(l, key));
-        strcpy(key, strlwc(l, key));
-        strcpy(value, strstrip(l, value));
-        /*
-         * sscanf cannot handle '' or "" as empty values
-         * this is done here
-         */
-        if (!strcmp(value, "\"\"") || (!strcmp(value, "''"))) {
-            value[0]=0 ;
+        return LINE_COMMENT ;
+    }
+    if (l.s[0]=='[' && l.s[l.len-1]==']') {
+        /* Section name, up to the first ']' */
+        p = memchr(l.s+1, ']', l.len-1);
+        section->s = p>l.s+1 ? l.s+1 : NULL ;
+        section->len = (int)(p-(l.s+1)) ;
+        strnstrip(section);
+        return LINE_SECTION ;
+    }
+    p = memchr(l.s, '=', l.len);
+    if (p==NULL || p==l.s) {
+        /* No key: syntax error */
+        return LINE_ERROR ;
+    }
+    key->s = l.s ;
+    key->len = (int)(p-l.s) ;
+    strnstrip(key);
+
+    value->s = p+1 ;
+    value->len = (int)(l.s+l.len-(p+1)) ;
+    while (value->len>0 && isspace((unsigned char)value->s[0])) {
+        value->s++ ;
+        value->len-- ;
+    }
+    i = 0 ;
+    if (value->len>1 && (value->s[0]=='"' || value->s[0]=='\'')) {
+        /* Quoted value, up to the closing quote or the end of line */
+        p = memchr(value->s+1, value->s[0], value->len-1);
+        i = p ? (int)(p-(value->s+1)) : value->len-1 ;
+        if (i>0) {
+            value->s++ ;
+            value->len = i ;
         }
-        sta = LINE_VALUE ;
-    } else if (sscanf(line, "%[^=] = %[;#]", key, value)==2
-           ||  sscanf(line, "%[^=] %[=]", key, value) == 2) {
-        /*
-         * Special cases:
-         * key=
-         * key=;
-         * key=#
-         */
-        strcpy(key, strstrip(l, key));
-        strcpy(key, strlwc(l, key));
-        value[0]=0 ;
-        sta = LINE_VALUE ;
-    } else {
-        /* Generate syntax error */
-        sta = LINE_ERROR ;
     }
-    return sta ;
+    if (i==0) {
+        /* Usual key=value, with or without comments. Empty for key=,
+         * key=; and key=# */
+        for (i=0 ; i<value->len && value->s[i]!=';' && value->s[i]!='#' ; i++)
+            ;
+        value->len = i ;
+    }
+    strnstrip(value);
+    /* "" and '' are empty values */
+    if (value->len==2 && (!memcmp(value->s, "\"\"", 2) || !memcmp(value->s, "''", 2)))
+        value->len = 0 ;
+    return LINE_VALUE ;
 }
 
 /*-------------------------------------------------------------------------*/
 /**
-  @brief    Parse an ini file and return an allocated dictionary object
-  @param    ininame Name of the ini file to read.
-  @return   Pointer to newly allocated dictionary
-
-  This is the parser for ini files. This function is called, providing
-  the name of the file to be read. It returns a dictionary object that
-  should not be accessed directly, but through accessor functions
-  instead.
-
-  The returned dictionary must be freed using iniparser_freedict().
+  @brief    Parse ini text into a new dictionary
+  @param    ini     Text to parse, does not have to be 0-terminated.
+  @param    inilen  Length of the text.
+  @param    ininame Name used in error messages.
+  @return   Pointer to newly allocated dictionary, NULL on error
+
+  Single pass over the text. Lines are looked at in place, only lines
+  continued with a trailing backslash are joined in a scratch buffer.
+  Each key ("section:key") and its value are written lowercased and
+  0-terminated next to each other in dictionary_alloc() space, so the
+  whole file costs one arena chunk or a few instead of two malloc()s per
+  entry, and it all goes away with iniparser_freedict().
  */
 /*--------------------------------------------------------------------------*/
-dictionary * iniparser_load(const char * ininame)
+static dictionary * iniparser_parse(
+    const char * ini,
+    int          inilen,
+    const char * ininame)
 {
-    FILE * in ;
-
-    char line    [ASCIILINESZ+1] ;
-    char section [ASCIILINESZ+1] ;
-    char key     [ASCIILINESZ+1] ;
-    char tmp     [ASCIILINESZ+1] ;
-    char val     [ASCIILINESZ+1] ;
+    const char * end ;
+    const char * eol ;
+    const char * line ;
+    char       * join=NULL ;
+    char       * tmp ;
+    char       * sec="" ;
+    char       * k ;
+
+    ini_span     section ;
+    ini_span     key ;
+    ini_span     val ;
 
-    int  last=0 ;
     int  len ;
+    int  last=0 ;
+    int  joined=0 ;
+    int  joinsz=0 ;
+    int  seclen=0 ;
     int  lineno=0 ;
-    int  errs=0;
+    int  errs=0 ;
+    int  i ;
 
     dictionary * dict ;
 
-    if ((in=fopen(ininame, "r"))==NULL) {
-        fprintf(stderr, "iniparser: cannot open %s\n", ininame);
-        return NULL ;
-    }
-
     dict = dictionary_new(0) ;
     if (!dict) {
-        fclose(in);
         return NULL ;
     }
 
-    memset(line,    0, ASCIILINESZ);
-    memset(section, 0, ASCIILINESZ);
-    memset(key,     0, ASCIILINESZ);
-    memset(val,     0, ASCIILINESZ);
-    last=0 ;
-
-    while (fgets(line+last, ASCIILINESZ-last, in)!=NULL) {
+    /* Keys get a section prefix, blanks and comments are dropped: the
+     * text plus a quarter is usually enough */
+    if (dictionary_reserve(dict, inilen+inilen/4+1)!=0) {
+        dictionary_del(dict);
+        return NULL ;
+    }
+    end = ini + inilen ;
+    while (ini<end) {
         lineno++ ;
-        len = (int)strlen(line)-1;
-        /* Safety check against buffer overflows */
-        if (line[len]!='\n') {
-            fprintf(stderr,
-                    "iniparser: input line too long in %s (%d)\n",
-                    ininame,
-                    lineno);
-            dictionary_del(dict);
-            fclose(in);
-            return NULL ;
-        }
-        /* Get rid of \n and spaces at end of line */
-        while ((len>=0) &&
-                ((line[len]=='\n') || (isspace(line[len])))) {
-            line[len]=0 ;
+        eol = memchr(ini, '\n', end-ini);
+        if (eol==NULL)
+            eol = end ;
+        line = ini ;
+        len = (int)(eol-ini) ;
+        ini = eol<end ? eol+1 : end ;
+
+        /* Get rid of \r and spaces at end of line */
+        while (len>0 && isspace((unsigned char)line[len-1]))
             len-- ;
-        }
         /* Detect multi-line */
-        if (line[len]=='\\') {
-            /* Multi-line value */
-            last=len ;
-            continue ;
-        } else {
-            last=0 ;
+        if (joined || (len>0 && line[len-1]=='\\')) {
+            if (last+len>joinsz) {
+                joinsz = 2*(last+len) ;
+                tmp = (char *)realloc(join, joinsz);
+                if (tmp==NULL) {
+                    errs = -1 ;
+                    break ;
+                }
+                join = tmp ;
+            }
+            memcpy(join+last, line, len);
+            last += len ;
+            while (last>0 && isspace((unsigned char)join[last-1]))
+                last-- ;
+            if (last>0 && join[last-1]=='\\') {
+                /* Multi-line value, the next line replaces the '\' */
+                last-- ;
+                joined = 1 ;
+                continue ;
+            }
+            line = join ;
+            len = last ;
         }
-        switch (iniparser_line(line, section, key, val)) {
+        last = 0 ;
+        joined = 0 ;
+
+        switch (iniparser_line(line, len, &section, &key, &val)) {
             case LINE_EMPTY:
             case LINE_COMMENT:
             break ;
 
             case LINE_SECTION:
-            errs = dictionary_set(dict, section, NULL);
+            if (section.s==NULL) {
+                /* "[]" sets the current section again */
+                errs = dictionary_set(dict, sec, NULL);
+                break ;
+            }
+            sec = dictionary_alloc(dict, section.len+1);
+            if (sec==NULL) {
+                errs = -1 ;
+                break ;
+            }
+            for (i=0 ; i<section.len ; i++)
+                sec[i] = (char)tolower((unsigned char)section.s[i]);
+            sec[i] = (char)0 ;
+            seclen = section.len ;
+            errs = dictionary_set_ref(dict, sec, NULL);
             break ;
 
             case LINE_VALUE:
-            sprintf(tmp, "%s:%s", section, key);
-            errs = dictionary_set(dict, tmp, val) ;
+            /* "section:key\0value\0" */
+            k = dictionary_alloc(dict, seclen+1+key.len+1+val.len+1);
+            if (k==NULL) {
+                errs = -1 ;
+                break ;
+            }
+            memcpy(k, sec, seclen);
+            k[seclen] = ':' ;
+            tmp = k+seclen+1 ;
+            for (i=0 ; i<key.len ; i++)
+                *tmp++ = (char)tolower((unsigned char)key.s[i]);
+            *tmp++ = (char)0 ;
+            memcpy(tmp, val.s, val.len);
+            tmp[val.len] = (char)0 ;
+            errs = dictionary_set_ref(dict, k, tmp) ;
             break ;
 
             case LINE_ERROR:
             fprintf(stderr, "iniparser: syntax error in %s (%d):\n",
                     ininame,
                     lineno);
-            fprintf(stderr, "-> %s\n", line);
+            fprintf(stderr, "-> %.*s\n", len, line);
             errs++ ;
             break;
 
             default:
             break ;
         }
-        memset(line, 0, ASCIILINESZ);
-        last=0;
         if (errs<0) {
             fprintf(stderr, "iniparser: memory allocation failure\n");
             break ;
         }
     }
+    free(join);
     if (errs) {
         dictionary_del(dict);
         dict = NULL ;
     }
-    fclose(in);
     return dict ;
 }
 
-/* 
- * Get a line from a buffer 
- * fgets() standard
- */
-int
-getnstr(char *buf, const char *str, size_t n)
-{
-        int r = 0;
-
-        if (n != 0) {
-        char *d = buf;
-        const char *s = str;
-
-    /* 
-     * clean the space after the first charactor of '\r', '\n' or 0 in the string
-     * put the string into buffer
-     * and get the position that the string ends
-     */
-        do {
-            *d = *s;
-            if ( *d == '\r' || *d == '\n' || *d == 0) {
-                if (*d == '\r' && s[1] == '\n' && n != 1) {
-                        d++;
-                        s++;
-                        n--;
-                        *d = *s;
-                }
-                if (--n != 0) 
-                        *++d = 0;
-                else
-                        *d=0;
-                r = d - buf;
-                break;
-            }
-            d++;
-            s++;
-        } while (--n != 0);
-    }
-
-    /* return the position that the string ends.*/
-    return (r);
-}
-
 /*-------------------------------------------------------------------------*/
 /**
   @brief    Parse an ini file and return an allocated dictionary object
@@ -682,105 +697,97 @@ getnstr(char *buf, const char *str, size_t n)
   should not be accessed directly, but through accessor functions
   instead.
 
+  The file is read into a private buffer and parsed from there, so a
+  file truncated or rewritten while it is loaded only yields a short or
+  mixed read, never a fault.
+
   The returned dictionary must be freed using iniparser_freedict().
  */
 /*--------------------------------------------------------------------------*/
-dictionary * iniparser_load_mem(const char *ini, int inilen)
+dictionary * iniparser_load(const char * ininame)
 {
-
-    char line    [ASCIILINESZ+1] ;
-    char section [ASCIILINESZ+1] ;
-    char key     [ASCIILINESZ+1] ;
-    char tmp     [ASCIILINESZ+1] ;
-    char val     [ASCIILINESZ+1] ;
-
-    int  last=0 ;
-    int  len ;
-    int  lineno=0 ;
-    int  errs=0;
-    int  rpos=0;
-    int  tpos=0;
-
+    struct stat  st ;
     dictionary * dict ;
-
-    dict = dictionary_new(0) ;
-    if (!dict) {
+    char       * ini ;
+    char       * tmp ;
+    ssize_t      r ;
+    int          inilen=0 ;
+    int          size ;
+    int          fd ;
+
+    if ((fd=open(ininame, O_RDONLY))<0 || fstat(fd, &st)<0) {
+        fprintf(stderr, "iniparser: cannot open %s\n", ininame);
+        if (fd>=0)
+            close(fd);
         return NULL ;
     }
-
-    memset(line,    0, ASCIILINESZ);
-    memset(section, 0, ASCIILINESZ);
-    memset(key,     0, ASCIILINESZ);
-    memset(val,     0, ASCIILINESZ);
-    last=0 ;
-
-	while (((rpos = getnstr(line+last, ini+tpos, ASCIILINESZ-last))!= 0) &&
-		(tpos < inilen)){
-        lineno++ ;
-        tpos += rpos;
-        len = (int)strlen(line);
-        /* Safety check against buffer overflows */
-        /*
-        if (line[len]!='\n') {
-            fprintf(stderr,
-                    "iniparser: input line too long in %s (%d)\n",
-                    "memory",
-                    lineno);
-            dictionary_del(dict);
-            return NULL ;
-        }
-        */
-        /* Get rid of \n and spaces at end of line */
-        while ((len>=0) &&
-                ((line[len]=='\n') || (isspace(line[len])))) {
-            line[len]=0 ;
-            len-- ;
+    if (S_ISREG(st.st_mode) && st.st_size>INT_MAX) {
+        fprintf(stderr, "iniparser: %s is too large\n", ininame);
+        close(fd);
+        return NULL ;
+    }
+    /* One read past the size seen by fstat() finds EOF, the buffer still
+       grows if the file does */
+    size = 4096 ;
+    if (S_ISREG(st.st_mode) && st.st_size>=size && st.st_size<INT_MAX)
+        size = (int)st.st_size+1 ;
+    ini = NULL ;
+    for (;;) {
+        if (ini==NULL || inilen==size) {
+            if (ini!=NULL) {
+                if (size>INT_MAX/2) {
+                    r = -1 ;
+                    break ;
+                }
+                size *= 2 ;
+            }
+            if ((tmp=(char *)realloc(ini, size))==NULL) {
+                r = -1 ;
+                break ;
+            }
+            ini = tmp ;
         }
-        /* Detect multi-line */
-        if (line[len]=='\\') {
-            /* Multi-line value */
-            last=len ;
+        r = read(fd, ini+inilen, size-inilen);
+        if (r<0 && errno==EINTR)
             continue ;
-        } else {
-            last=0 ;
-        }
-        switch (iniparser_line(line, section, key, val)) {
-            case LINE_EMPTY:
-            case LINE_COMMENT:
+        if (r<=0)
             break ;
+        inilen += (int)r ;
+    }
+    close(fd);
+    if (r<0) {
+        fprintf(stderr, "iniparser: cannot read %s\n", ininame);
+        free(ini);
+        return NULL ;
+    }
+    dict = iniparser_parse(ini, inilen, ininame);
+    free(ini);
+    return dict ;
+}
 
-            case LINE_SECTION:
-            errs = dictionary_set(dict, section, NULL);
-            break ;
+/*-------------------------------------------------------------------------*/
+/**
+  @brief    Parse ini text in memory and return an allocated dictionary
+  @param    ini     Text to parse.
+  @param    inilen  Length of the text, parsing also stops at a 0 byte.
+  @return   Pointer to newly allocated dictionary
 
-            case LINE_VALUE:
-            sprintf(tmp, "%s:%s", section, key);
-            errs = dictionary_set(dict, tmp, val) ;
-            break ;
+  Same as iniparser_load() for text that is already in memory. The text
+  is not modified and can be released as soon as this returns.
 
-            case LINE_ERROR:
-            fprintf(stderr, "iniparser: syntax error in %s (%d):\n",
-                    "memory",
-                    lineno);
-            fprintf(stderr, "-> %s\n", line);
-            errs++ ;
-            break;
+  The returned dictionary must be freed using iniparser_freedict().
+ */
+/*--------------------------------------------------------------------------*/
+dictionary * iniparser_load_mem(const char *ini, int inilen)
+{
+    const char * nul ;
 
-            default:
-            break ;
-        }
-        memset(line, 0, ASCIILINESZ);
-        last=0;
-        if (errs<0) {
-            fprintf(stderr, "iniparser: memory allocation failure\n");
-            break ;
-        }
-    }
-    if (errs) {
-        dictionary_del(dict);
-        dict = NULL ;
-    }
-    return dict ;
+    if (ini==NULL || inilen<0)
+        return NULL ;
+    nul = memchr(ini, 0, inilen);
+    if (nul!=NULL)
+        inilen = (int)(nul-ini) ;
+    return iniparser_parse(ini, inilen, "memory");
 }
 
 
@@ -4,7 +4,10 @@
 
 # Compiler settings
 CC      = gcc
-CFLAGS  = -g -fPIC -Wall -I../include #-ansi -pedantic -I../include 
+CFLAGS  = -g -fPIC -Wall -I../include -I$(SCDB) #-ansi -pedantic -I../include 
+
+# scdb, for libconfcdb.a
+SCDB    = ../scdb
 
 # Ar settings to build the library
 AR	    = ar
@@ -33,11 +36,12 @@ COMPILE.c=$(CC) $(CFLAGS) -c
 
 SRCS = iniparser.c \
 	dictionary.c \
-	confparser.c	
+	confparser.c \
+	confreload.c
 
 OBJS = $(SRCS:.c=.o)
 
-default:	libconfparser.a libconfparser.so
+default:	libconfparser.a libconfparser.so libconfcdb.a
 
 libconfparser.a:	$(OBJS)
 	@($(AR) $(ARFLAGS) $@ $(OBJS))
@@ -45,8 +49,26 @@ libconfparser.a:	$(OBJS)
 	#mv -f $@ ../../lib/
 
 
+dictionary_bench:	libconfparser.a dictionary_bench.c
+	$(CC) $(CFLAGS) -O2 -o $@ dictionary_bench.c libconfparser.a
+
+# INI compiled into a cdb, link with $(SCDB)/libscdb.a -lz -lpthread
+libconfcdb.a:	confcdb.o
+	@($(AR) $(ARFLAGS) $@ confcdb.o)
+	@($(RANLIB) $@)
+
+$(SCDB)/libscdb.a:
+	@(cd $(SCDB) ; $(MAKE) libscdb.a)
+
+confreload_bench:	libconfparser.a confreload_bench.c
+	$(CC) $(CFLAGS) -O2 -o $@ confreload_bench.c libconfparser.a -lpthread
+
+confcdb_bench:	libconfcdb.a libconfparser.a $(SCDB)/libscdb.a confcdb_bench.c
+	$(CC) $(CFLAGS) -O2 -o $@ confcdb_bench.c libconfcdb.a libconfparser.a \
+		$(SCDB)/libscdb.a -lz -lpthread
+
 libconfparser.so:	$(OBJS)
-	@$(SHLD) $(LDSHFLAGS) -o $@.0 $(OBJS) $(LDFLAGS) \
+	@$(SHLD) $(LDSHFLAGS) -o $@.0 $(OBJS) $(LDFLAGS) -lpthread \
 		-Wl,-soname=`basename $@`.0
 	#cp $@.0 /usr/local/lib
 	#ln -sf /usr/local/lib/$@.0 /usr/local/lib/$@
@@ -57,8 +79,9 @@ libconfparser.so:	$(OBJS)
 .PHONY: clean veryclean docs check
 
 clean:
-	$(RM) $(OBJS)
+	$(RM) $(OBJS) confcdb.o
 	$(RM) *.so *.a *.so.0
+	$(RM) dictionary_bench confcdb_bench confreload_bench
 
 veryclean:
 	$(RM) $(OBJS) libconfparser.a libconfparser.so*
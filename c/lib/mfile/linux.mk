@@ -23,6 +23,12 @@ WARN    = $(warn)
 libmfile.a: $(OBJS)
 	$(AR) $(ARFLAGS) $@ $(OBJS)
 
+mfile_bench: libmfile.a mfile_bench.c
+	$(CC) $(WARN) -O2 -o $@ mfile_bench.c $(CFLAGS) $(IFLAGS) libmfile.a -lpthread
+
+mfile_write_bench: libmfile.a mfile_write_bench.c
+	$(CC) $(WARN) -O2 -o $@ mfile_write_bench.c $(CFLAGS) $(IFLAGS) libmfile.a -lpthread
+
 
 
 install:
@@ -39,6 +45,8 @@ clean:
 	#rm -f $(OBJS) ../../lib/libmfile.a
 	rm -f *.o
 	rm -f libmfile.a
+	rm -f mfile_bench
+	rm -f mfile_write_bench
 	rm -f $(OBJS) $(LIBDIR)/libmfile.a
 	rm -f $(INCDIR)/mfile.h
 	rm -f $(INCDIR)/queue.h
@@ -1,8 +1,18 @@
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 
 #include "mfile.h"
 //#define MALLOC_DEBUG
@@ -13,6 +23,453 @@
 //int total_free;
 //#endif
 
+#define MPOOL_ALIGN(n)  (((n) + 15) & ~(size_t)15)
+
+#define MSTREAM_SPIN  64
+
+#ifdef IOV_MAX
+#define MFILE_IOV_MAX  IOV_MAX
+#else
+#define MFILE_IOV_MAX  1024
+#endif
+
+/*
+* mpool_create()
+* @block_size: payload size of every block, 0 for DEFAULT_DATA_BLOCK_SIZE
+* @slab_blocks: blocks carved from one slab, 0 for DEFAULT_SLAB_BLOCKS
+* @flags: MPOOL_SHARED if MFILEs of several threads use the pool
+* Upon successful completion mpool_create() return a MPOOL pointer.
+* Otherwise, NULL is returned
+*/
+MPOOL *
+mpool_create(int block_size, int slab_blocks, int flags)
+{
+	MPOOL *pool;
+
+	if (block_size < 0 || slab_blocks < 0)
+		return NULL;
+	pool = malloc(sizeof(MPOOL));
+	if (NULL == pool) {
+		fprintf(stderr, "malloc error in mpool_create\n");
+		return NULL;
+	}
+	memset(pool, 0, sizeof(MPOOL));
+	pool->block_size = block_size ? block_size : DEFAULT_DATA_BLOCK_SIZE;
+	pool->slab_blocks = slab_blocks ? slab_blocks : DEFAULT_SLAB_BLOCKS;
+	pool->flags = flags;
+	if (flags & MPOOL_SHARED)
+		pthread_mutex_init(&pool->lock, NULL);
+	return pool;
+}
+
+/*
+* mpool_destroy()
+* @pool: all MFILEs using the pool must be closed before
+*/
+void
+mpool_destroy(MPOOL *pool)
+{
+	void *slab;
+
+	if (NULL == pool)
+		return;
+	while (pool->slabs != NULL) {
+		slab = pool->slabs;
+		pool->slabs = *(void **)slab;
+		free(slab);
+	}
+	if (pool->flags & MPOOL_SHARED)
+		pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/*
+* mpool_stat()
+* @stat: filled with a snapshot of the counters
+*/
+void
+mpool_stat(MPOOL *pool, MPOOL_STAT *stat)
+{
+	if (pool->flags & MPOOL_SHARED)
+		pthread_mutex_lock(&pool->lock);
+	*stat = pool->stat;
+	if (pool->flags & MPOOL_SHARED)
+		pthread_mutex_unlock(&pool->lock);
+}
+
+/* carve a new slab into the free list, called with the lock held */
+static int
+mpool_grow(MPOOL *pool)
+{
+	size_t head_size = MPOOL_ALIGN(sizeof(DATA_BLOCK));
+	size_t unit = head_size + MPOOL_ALIGN(pool->block_size);
+	char *slab;
+	DATA_BLOCK *b;
+	int i;
+
+	slab = malloc(MPOOL_ALIGN(sizeof(void *)) + unit * pool->slab_blocks);
+	if (NULL == slab)
+		return -1;
+	*(void **)slab = pool->slabs;
+	pool->slabs = slab;
+
+	slab += MPOOL_ALIGN(sizeof(void *));
+	for (i = 0; i < pool->slab_blocks; i++) {
+		b = (DATA_BLOCK *)(slab + unit * i);
+		b->data = (char *)b + head_size;
+		b->pool = pool;
+		TAILQ_NEXT(b, entries) = pool->free_list;
+		pool->free_list = b;
+	}
+	pool->stat.slabs++;
+	pool->stat.blocks += pool->slab_blocks;
+	return 0;
+}
+
+static DATA_BLOCK *
+mpool_get(MPOOL *pool)
+{
+	DATA_BLOCK *b = NULL;
+
+	if (pool->flags & MPOOL_SHARED)
+		pthread_mutex_lock(&pool->lock);
+	if (pool->free_list != NULL)
+		pool->stat.reuses++;
+	else if (mpool_grow(pool) == -1)
+		goto out;
+	b = pool->free_list;
+	pool->free_list = TAILQ_NEXT(b, entries);
+	pool->stat.gets++;
+	pool->stat.in_use++;
+out:
+	if (pool->flags & MPOOL_SHARED)
+		pthread_mutex_unlock(&pool->lock);
+	return b;
+}
+
+static void
+mpool_put(MPOOL *pool, DATA_BLOCK *b)
+{
+	if (pool->flags & MPOOL_SHARED)
+		pthread_mutex_lock(&pool->lock);
+	TAILQ_NEXT(b, entries) = pool->free_list;
+	pool->free_list = b;
+	pool->stat.in_use--;
+	if (pool->flags & MPOOL_SHARED)
+		pthread_mutex_unlock(&pool->lock);
+}
+
+static void
+spill_map_release(MSPILL_MAP *map)
+{
+	if (__sync_sub_and_fetch(&map->refs, 1) > 0)
+		return;
+	munmap(map->base, map->len);
+	free(map);
+}
+
+static void
+spill_release(MSPILL *spill)
+{
+	if (__sync_sub_and_fetch(&spill->refs, 1) > 0)
+		return;
+	if (spill->map != NULL)
+		spill_map_release(spill->map);
+	close(spill->fd);
+	free(spill);
+}
+
+/* create the handler's temp file, unlinked at once */
+static MSPILL *
+spill_open(MFILE *handler)
+{
+	MSPILL *spill;
+	char path[1024];
+	const char *dir;
+	long page;
+
+	dir = handler->spill_dir;
+	if (NULL == dir)
+		dir = getenv("TMPDIR");
+	if (NULL == dir)
+		dir = "/tmp";
+	snprintf(path, sizeof(path), "%s/mfile.XXXXXX", dir);
+
+	spill = malloc(sizeof(MSPILL));
+	if (NULL == spill)
+		return NULL;
+	memset(spill, 0, sizeof(MSPILL));
+	spill->fd = mkstemp(path);
+	if (spill->fd == -1) {
+		fprintf(stderr, "mkstemp %s error\n", path);
+		free(spill);
+		return NULL;
+	}
+	unlink(path);
+	page = sysconf(_SC_PAGESIZE);
+	spill->map_size = MSPILL_WINDOW;
+	if (spill->map_size < (size_t)handler->DATA_BLOCK_SIZE)
+		spill->map_size = handler->DATA_BLOCK_SIZE;
+	spill->map_size = (spill->map_size + page - 1) & ~(page - 1);
+	spill->refs = 1;
+	return spill;
+}
+
+/*
+* spill_map_next()
+* Map the next window of the temp file, from the first page boundary at
+* or after the last block. The file is only extended block by block.
+* Upon successful completion spill_map_next() return 0.
+* Otherwise, -1 is returned
+*/
+static int
+spill_map_next(MSPILL *spill)
+{
+	MSPILL_MAP *map;
+	off_t off;
+	long page;
+
+	page = sysconf(_SC_PAGESIZE);
+	off = (spill->size + page - 1) & ~((off_t)page - 1);
+	map = malloc(sizeof(MSPILL_MAP));
+	if (NULL == map)
+		return -1;
+	map->base = mmap(NULL, spill->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		spill->fd, off);
+	if (MAP_FAILED == map->base) {
+		free(map);
+		return -1;
+	}
+	map->len = spill->map_size;
+	map->refs = 1;
+	if (spill->map != NULL)
+		spill_map_release(spill->map);
+	spill->map = map;
+	spill->map_off = off;
+	spill->size = off;
+	return 0;
+}
+
+/*
+* block_spill()
+* Take a new block from the current window of the handler's temp file,
+* right after the previous one, so consecutive blocks are adjacent in the
+* file and share one mapping. The space is allocated first, so a full
+* disk fails here instead of faulting in memcpy().
+* Otherwise, NULL is returned
+*/
+static DATA_BLOCK *
+block_spill(MFILE *handler)
+{
+	MSPILL *spill;
+	DATA_BLOCK *b;
+
+	if (NULL == handler->spill) {
+		handler->spill = spill_open(handler);
+		if (NULL == handler->spill)
+			return NULL;
+	}
+	spill = handler->spill;
+	if (NULL == spill->map
+		|| spill->size + handler->DATA_BLOCK_SIZE
+			> spill->map_off + (off_t)spill->map->len) {
+		if (spill_map_next(spill) == -1)
+			return NULL;
+	}
+	if (posix_fallocate(spill->fd, spill->size, handler->DATA_BLOCK_SIZE) != 0)
+		return NULL;
+	b = handler->alloc_fun(sizeof(DATA_BLOCK));
+	if (NULL == b)
+		return NULL;
+	memset(b, 0, sizeof(DATA_BLOCK));
+	b->data = spill->map->base + (spill->size - spill->map_off);
+	b->spill = spill;
+	b->spill_map = spill->map;
+	b->spill_off = spill->size;
+	b->free_fun = handler->free_fun;
+	b->refs = 1;
+	spill->size += handler->DATA_BLOCK_SIZE;
+	__sync_add_and_fetch(&spill->refs, 1);
+	__sync_add_and_fetch(&spill->map->refs, 1);
+	return b;
+}
+
+/*
+* spill_dontneed()
+* Drop the pages of a full spilled block from the RSS. The page it ends
+* in is left alone, the next block is written there.
+*/
+static void
+spill_dontneed(DATA_BLOCK *b, int size)
+{
+	uintptr_t start, end;
+	long page;
+
+	page = sysconf(_SC_PAGESIZE);
+	start = (uintptr_t)b->data & ~((uintptr_t)page - 1);
+	end = ((uintptr_t)b->data + size) & ~((uintptr_t)page - 1);
+	if (end > start)
+		madvise((void *)start, end - start, MADV_DONTNEED);
+}
+
+/*
+* block_new()
+* Take a cleared block from the handler's pool, or allocate header and
+* payload with alloc_fun. Past the spill threshold the block is mapped
+* from a temp file, memory is used if that fails.
+*/
+static DATA_BLOCK *
+block_new(MFILE *handler)
+{
+	DATA_BLOCK *b;
+	char *data;
+
+	if (handler->spill_threshold > 0
+		&& handler->total_size > handler->spill_threshold) {
+		b = block_spill(handler);
+		if (b != NULL)
+			return b;
+	}
+
+	if (handler->pool != NULL) {
+		b = mpool_get(handler->pool);
+		if (NULL == b) {
+			fprintf(stderr, "mpool_get data_block error\n");
+			return NULL;
+		}
+		data = b->data;
+		memset(b, 0, sizeof(DATA_BLOCK));
+		b->data = data;
+		b->pool = handler->pool;
+		b->refs = 1;
+		return b;
+	}
+
+	b = handler->alloc_fun(sizeof(DATA_BLOCK));
+	if (NULL == b) {
+		fprintf(stderr, "alloc_fun data_block error\n");
+		return NULL;
+	}
+#ifdef MALLOC_DEBUG
+	++total_malloc;
+#endif
+	memset(b, 0, sizeof(DATA_BLOCK));
+	b->data = (char *)handler->alloc_fun(handler->DATA_BLOCK_SIZE);
+	if (NULL == b->data) {
+		fprintf(stderr, "alloc_fun data buffer error\n");
+		handler->free_fun(b);
+		return NULL;
+	}
+#ifdef MALLOC_DEBUG
+	++total_malloc;
+#endif
+	b->free_fun = handler->free_fun;
+	b->refs = 1;
+	return b;
+}
+
+/*
+* block_release()
+* Drop one reference to a block owning its data. The last one frees it,
+* even if the MFILE it was written to is already closed.
+*/
+static void
+block_release(DATA_BLOCK *b)
+{
+	if (__sync_sub_and_fetch(&b->refs, 1) > 0)
+		return;
+	if (b->spill != NULL) {
+		spill_map_release(b->spill_map);
+		spill_release(b->spill);
+		b->free_fun(b);
+		return;
+	}
+	if (b->pool != NULL) {
+		mpool_put(b->pool, b);
+		return;
+	}
+	b->free_fun(b->data);
+	b->free_fun(b);
+#ifdef MALLOC_DEBUG
+	total_free += 2;
+#endif
+}
+
+static void
+block_free(MFILE *handler, DATA_BLOCK *b)
+{
+	if (b->shared != NULL) {
+		block_release(b->shared);
+		handler->free_fun(b);
+#ifdef MALLOC_DEBUG
+		++total_free;
+#endif
+		return;
+	}
+	block_release(b);
+}
+
+/*
+* block_view()
+* @b: block of another MFILE, or a slice
+* Return a block sharing len bytes of b's data from in, nothing is copied.
+* Otherwise, NULL is returned
+*/
+static DATA_BLOCK *
+block_view(MFILE *handler, DATA_BLOCK *b, int in, int len)
+{
+	DATA_BLOCK *v;
+
+	v = handler->alloc_fun(sizeof(DATA_BLOCK));
+	if (NULL == v) {
+		fprintf(stderr, "alloc_fun data_block error\n");
+		return NULL;
+	}
+#ifdef MALLOC_DEBUG
+	++total_malloc;
+#endif
+	memset(v, 0, sizeof(DATA_BLOCK));
+	v->shared = b->shared != NULL ? b->shared : b;
+	v->data = b->data + in;
+	v->current_write_count = len;
+	v->data_len = len;
+	__sync_add_and_fetch(&v->shared->refs, 1);
+	return v;
+}
+
+/*
+* block_unshare()
+* Copy on write: replace the handler's tail slice by a private copy
+* before mwrite() appends to it.
+* Upon successful completion block_unshare() return 0.
+* Otherwise, -1 is returned
+*/
+static int
+block_unshare(MFILE *handler)
+{
+	DATA_BLOCK *old = handler->current_write_p;
+	DATA_BLOCK *b;
+
+	b = block_new(handler);
+	if (NULL == b)
+		return -1;
+	memcpy(b->data, old->data, old->current_write_count);
+	b->current_write_count = old->current_write_count;
+	b->data_len = old->data_len;
+	b->offset = old->offset;
+	TAILQ_INSERT_AFTER(&handler->head, old, b, entries);
+	TAILQ_REMOVE(&handler->head, old, entries);
+	if (handler->index_ok)
+		handler->index[handler->block_num - 1] = b;
+	if (handler->current_read_p == old) {
+		b->current_read_count = old->current_read_count;
+		handler->current_read_p = b;
+	}
+	handler->current_write_p = b;
+	block_free(handler, old);
+	return 0;
+}
+
 /*
 * mopen()
 * @data_block_size:  block size
@@ -48,6 +505,7 @@ mopen(int data_block_size, USER_ALLOCER *af, USER_FREER *fe)
 	TAILQ_INIT(&handler->head);
 	handler->is_full = 1;
 	handler->is_empty = 0;
+	handler->index_ok = 1;
 	handler->ccache = '\n';
 	if (data_block_size == 0) {
 		handler->DATA_BLOCK_SIZE = DEFAULT_DATA_BLOCK_SIZE;
@@ -57,6 +515,287 @@ mopen(int data_block_size, USER_ALLOCER *af, USER_FREER *fe)
 	return handler;
 }
 
+/*
+* mopen_pool()
+* @pool: blocks are taken from and returned to this pool,
+*        the block size is the pool's block size
+* Upon successful completion mopen_pool() return a MFILE pointer.
+* Otherwise, NULL is returned
+*/
+MFILE *
+mopen_pool(MPOOL *pool)
+{
+	MFILE *handler;
+
+	if (NULL == pool)
+		return NULL;
+	handler = mopen(pool->block_size, NULL, NULL);
+	if (NULL == handler)
+		return NULL;
+	handler->pool = pool;
+	return handler;
+}
+
+/*
+* mset_spill()
+* @threshold: blocks created once msize() is above threshold are
+*             mapped from an unlinked temp file, 0 turns spilling off
+* @dir: directory of the temp file, NULL for $TMPDIR or /tmp
+* Upon successful completion mset_spill() return 0.
+* Otherwise, -1 is returned
+*/
+int
+mset_spill(MFILE *handler, int threshold, const char *dir)
+{
+	char *d = NULL;
+
+	if (NULL == handler || threshold < 0)
+		return -1;
+	if (dir != NULL) {
+		d = strdup(dir);
+		if (NULL == d)
+			return -1;
+	}
+	free(handler->spill_dir);
+	handler->spill_dir = d;
+	handler->spill_threshold = threshold;
+	return 0;
+}
+
+/*
+* mopen_stream()
+* @pool: NULL for blocks from malloc, else it must be MPOOL_SHARED since
+*        blocks are taken by the writer and put back by the reader
+* @max_blocks: mstream_write() waits while this many blocks are unread,
+*              0 for no limit
+* Only mstream_write(), mstream_end(), mstream_read() and mclose() may
+* be used on the handler; mclose() after both threads are done.
+* Upon successful completion mopen_stream() return a MFILE pointer.
+* Otherwise, NULL is returned
+*/
+MFILE *
+mopen_stream(MPOOL *pool, int max_blocks)
+{
+	MFILE *handler;
+	MSTREAM *s;
+
+	if (max_blocks < 0 || (pool != NULL && !(pool->flags & MPOOL_SHARED)))
+		return NULL;
+	handler = pool != NULL ? mopen_pool(pool) : mopen(0, NULL, NULL);
+	if (NULL == handler)
+		return NULL;
+	s = malloc(sizeof(MSTREAM));
+	if (NULL == s) {
+		mclose(handler);
+		return NULL;
+	}
+	memset(s, 0, sizeof(MSTREAM));
+	s->max_blocks = max_blocks;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->readable, NULL);
+	pthread_cond_init(&s->writable, NULL);
+	handler->stream = s;
+	return handler;
+}
+
+/* reader: unread data or a next block */
+static int
+stream_has_data(MFILE *handler)
+{
+	DATA_BLOCK *b = handler->current_read_p;
+
+	if (NULL == b)
+		b = __atomic_load_n(&TAILQ_FIRST(&handler->head), __ATOMIC_SEQ_CST);
+	return b != NULL
+		&& (b->current_read_count
+			< __atomic_load_n(&b->current_write_count, __ATOMIC_SEQ_CST)
+		|| __atomic_load_n(&TAILQ_NEXT(b, entries), __ATOMIC_SEQ_CST) != NULL);
+}
+
+static int
+stream_readable(MFILE *handler)
+{
+	return stream_has_data(handler)
+		|| __atomic_load_n(&handler->stream->closed, __ATOMIC_SEQ_CST);
+}
+
+/* writer: room in the window for a new block */
+static int
+stream_writable(MFILE *handler)
+{
+	MSTREAM *s = handler->stream;
+
+	return s->made - __atomic_load_n(&s->freed, __ATOMIC_SEQ_CST) < s->max_blocks;
+}
+
+/*
+* stream_wait()
+* Spin a little, then sleep until ready(). waiting is set before ready()
+* is checked again under the lock, and the other side reads waiting after
+* publishing, so a wakeup is never lost.
+*/
+static void
+stream_wait(MFILE *handler, int *waiting, pthread_cond_t *cond,
+	int (*ready)(MFILE *))
+{
+	MSTREAM *s = handler->stream;
+	int i;
+
+	for (i = 0; i < MSTREAM_SPIN; i++) {
+		if (ready(handler))
+			return;
+		sched_yield();
+	}
+	pthread_mutex_lock(&s->lock);
+	__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+	while (!ready(handler))
+		pthread_cond_wait(cond, &s->lock);
+	__atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void
+stream_wake(MSTREAM *s, int *waiting, pthread_cond_t *cond)
+{
+	if (!__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+		return;
+	pthread_mutex_lock(&s->lock);
+	pthread_cond_signal(cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+* mstream_write()
+* @handler: opened by mopen_stream(), called by the writer thread only
+* Each copied piece is published to the reader at once.
+* Upon successful completion mstream_write() return 1.
+* Otherwise, -1 is returned
+*/
+int
+mstream_write(MFILE *handler, const char *data, int len)
+{
+	MSTREAM *s;
+	DATA_BLOCK *b;
+	int n;
+
+	if (NULL == handler || NULL == handler->stream || len < 0)
+		return -1;
+	s = handler->stream;
+	while (len > 0) {
+		b = handler->current_write_p;
+		if (NULL == b || b->current_write_count == handler->DATA_BLOCK_SIZE) {
+			if (s->max_blocks > 0 && !stream_writable(handler))
+				stream_wait(handler, &s->write_waiting, &s->writable,
+					stream_writable);
+			b = block_new(handler);
+			if (NULL == b)
+				return -1;
+			b->offset = handler->total_size;
+			/* TAILQ_INSERT_TAIL, the link is the publication */
+			TAILQ_NEXT(b, entries) = NULL;
+			b->entries.tqe_prev = handler->head.tqh_last;
+			__atomic_store_n(handler->head.tqh_last, b, __ATOMIC_SEQ_CST);
+			handler->head.tqh_last = &TAILQ_NEXT(b, entries);
+			handler->current_write_p = b;
+			handler->block_num++;
+			s->made++;
+		}
+		n = handler->DATA_BLOCK_SIZE - b->current_write_count;
+		n = n < len ? n : len;
+		memcpy(b->data + b->current_write_count, data, n);
+		b->data_len = b->current_write_count + n;
+		__atomic_store_n(&b->current_write_count, b->data_len, __ATOMIC_SEQ_CST);
+		handler->total_size += n;
+		data += n;
+		len -= n;
+	}
+	stream_wake(s, &s->read_waiting, &s->readable);
+	return 1;
+}
+
+/*
+* mstream_end()
+* The writer is done, mstream_read() returns 0 after the last byte
+*/
+void
+mstream_end(MFILE *handler)
+{
+	if (NULL == handler || NULL == handler->stream)
+		return;
+	__atomic_store_n(&handler->stream->closed, 1, __ATOMIC_SEQ_CST);
+	stream_wake(handler->stream, &handler->stream->read_waiting,
+		&handler->stream->readable);
+}
+
+/*
+* mstream_read()
+* @handler: opened by mopen_stream(), called by the reader thread only
+* @flags: MSTREAM_NOWAIT to poll
+* Wait until some data is written, like read(2). Blocks read to the end
+* are released (back to the pool), the writer only keeps the tail.
+* Upon successful completion mstream_read() return size that you readed,
+* 0 after mstream_end() and the last byte.
+* Otherwise, -1 is returned (errno EAGAIN with MSTREAM_NOWAIT)
+*/
+int
+mstream_read(MFILE *handler, char *data, int len, int flags)
+{
+	MSTREAM *s;
+	DATA_BLOCK *b;
+	DATA_BLOCK *next;
+	int n, readed;
+
+	if (NULL == handler || NULL == handler->stream || len < 0)
+		return -1;
+	s = handler->stream;
+	readed = 0;
+	while (readed < len) {
+		b = handler->current_read_p;
+		if (NULL == b) {
+			b = __atomic_load_n(&TAILQ_FIRST(&handler->head), __ATOMIC_SEQ_CST);
+			handler->current_read_p = b;
+		}
+		if (b != NULL) {
+			n = __atomic_load_n(&b->current_write_count, __ATOMIC_SEQ_CST)
+				- b->current_read_count;
+			if (n > 0) {
+				n = n < len - readed ? n : len - readed;
+				memcpy(data + readed, b->data + b->current_read_count, n);
+				b->current_read_count += n;
+				readed += n;
+				continue;
+			}
+			/* the writer links the next block after filling this one */
+			next = __atomic_load_n(&TAILQ_NEXT(b, entries), __ATOMIC_SEQ_CST);
+			if (next != NULL) {
+				if (b->current_read_count
+					< __atomic_load_n(&b->current_write_count, __ATOMIC_SEQ_CST))
+					continue;
+				handler->current_read_p = next;
+				TAILQ_REMOVE(&handler->head, b, entries);
+				block_free(handler, b);
+				__atomic_add_fetch(&s->freed, 1, __ATOMIC_SEQ_CST);
+				stream_wake(s, &s->write_waiting, &s->writable);
+				continue;
+			}
+		}
+		if (readed > 0)
+			break;
+		/* closed is set after the last byte is published */
+		if (__atomic_load_n(&s->closed, __ATOMIC_SEQ_CST)) {
+			if (!stream_has_data(handler))
+				return 0;
+			continue;
+		}
+		if (flags & MSTREAM_NOWAIT) {
+			errno = EAGAIN;
+			return -1;
+		}
+		stream_wait(handler, &s->read_waiting, &s->readable, stream_readable);
+	}
+	return readed;
+}
+
 /*
 * mclose()
 * @handler: handler of savadata
@@ -72,53 +811,183 @@ mclose(MFILE *handler)
 	n1 = TAILQ_FIRST(&handler->head);
 	while (n1 != NULL) {
 		n2 = TAILQ_NEXT(n1, entries);
-		handler->free_fun(n1->data);
-		handler->free_fun(n1);
-#ifdef MALLOC_DEBUG
-		total_free += 2;
-#endif
+		block_free(handler, n1);
 		n1 = n2;
 	}
+	if (handler->spill != NULL)
+		spill_release(handler->spill);
+	if (handler->stream != NULL) {
+		pthread_mutex_destroy(&handler->stream->lock);
+		pthread_cond_destroy(&handler->stream->readable);
+		pthread_cond_destroy(&handler->stream->writable);
+		free(handler->stream);
+	}
+	free(handler->spill_dir);
+	free(handler->index);
 	free(handler);
 #ifdef MALLOC_DEBUG
 	++total_free;
 #endif
 }
 
+/*
+* index_add()
+* Append a new tail block to the offset index.
+* Upon successful completion index_add() return 0.
+* Otherwise, -1 is returned and the index is rebuilt on next use
+*/
+static int
+index_add(MFILE *handler, DATA_BLOCK *b)
+{
+	DATA_BLOCK **index;
+	DATA_BLOCK *prev;
+	int cap;
+
+	prev = TAILQ_PREV(b, mfile_head, entries);
+	b->offset = prev == NULL ? 0 : prev->offset + prev->current_write_count;
+	if (!handler->index_ok)
+		return 0;
+	if (handler->block_num > handler->index_cap) {
+		cap = handler->index_cap ? handler->index_cap * 2 : 16;
+		index = realloc(handler->index, cap * sizeof(DATA_BLOCK *));
+		if (NULL == index) {
+			handler->index_ok = 0;
+			return -1;
+		}
+		handler->index = index;
+		handler->index_cap = cap;
+	}
+	handler->index[handler->block_num - 1] = b;
+	return 0;
+}
+
+/* rebuild the index and block offsets, after mwrite_head() */
+static int
+index_build(MFILE *handler)
+{
+	DATA_BLOCK **index;
+	DATA_BLOCK *b;
+	int i, off;
+
+	if (handler->block_num > handler->index_cap) {
+		index = realloc(handler->index, handler->block_num * sizeof(DATA_BLOCK *));
+		if (NULL == index)
+			return -1;
+		handler->index = index;
+		handler->index_cap = handler->block_num;
+	}
+	i = 0;
+	off = 0;
+	TAILQ_FOREACH(b, &handler->head, entries) {
+		b->offset = off;
+		off += b->current_write_count;
+		handler->index[i++] = b;
+	}
+	handler->index_ok = 1;
+	return 0;
+}
+
+/*
+* block_at()
+* @pos: 0 <= pos <= total size
+* Return the index of the block holding pos, binary search on offsets.
+* pos at the very end gives the last block.
+* Otherwise, -1 is returned (no block or out of memory)
+*/
+static int
+block_at(MFILE *handler, int pos)
+{
+	int lo, hi, mid;
+
+	if (handler->block_num == 0)
+		return -1;
+	if (!handler->index_ok && index_build(handler) == -1)
+		return -1;
+	lo = 0;
+	hi = handler->block_num - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (handler->index[mid]->offset <= pos)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	/* skip blocks that end exactly at pos */
+	while (lo + 1 < handler->block_num
+		&& pos >= handler->index[lo]->offset + handler->index[lo]->current_write_count)
+		lo++;
+	return lo;
+}
+
 /* for Read-Many */
 void
 mseek(MFILE *handler)
 {
-	DATA_BLOCK *n1;
-	DATA_BLOCK *n2;
-
 	if (NULL == handler)
 		return;
 	handler->is_empty = 0;
 	handler->current_read_p = NULL;
-	n1 = TAILQ_FIRST(&handler->head);
-	while (n1 != NULL) {
-		n1->current_read_count = 0;
-		n2 = TAILQ_NEXT(n1, entries);
-		n1 = n2;
-	}
 }
 
+/*
+* mseek_pos()
+* @pos: next mread()/mgetc() starts here, O(log blocks)
+*/
 void mseek_pos(MFILE *handler, int pos)
 {
+	DATA_BLOCK *n1;
+	int i;
+
 	pos = pos < 0 ? 0 : pos;
 	mseek( handler );
-	DATA_BLOCK *n1;
-	n1 = TAILQ_FIRST(&handler->head);
-	while (n1 != NULL) {
-		if ( pos <= n1->current_write_count ) {
-			n1->current_read_count = pos;
-			handler->current_read_p = n1;
-			break;
-		}
-		pos -= n1->current_write_count;
-		n1 = TAILQ_NEXT(n1, entries);
+	i = block_at(handler, pos);
+	if (i == -1)
+		return;
+	n1 = handler->index[i];
+	if (pos > n1->offset + n1->current_write_count)
+		pos = n1->offset + n1->current_write_count;
+	n1->current_read_count = pos - n1->offset;
+	handler->current_read_p = n1;
+	handler->is_empty = n1->current_read_count == n1->current_write_count;
+}
+
+/*
+* mpread()
+* @handler: handler of savadata
+* @data: the data you want read
+* @len: length of data buffer
+* @offset: read from this position
+* Read without using or changing the handler's read position.
+* Upon successful completion mpread() return size that you readed,
+* 0 at the end. Otherwise, -1 is returned
+*/
+int
+mpread(MFILE *handler, char *data, int len, int offset)
+{
+	DATA_BLOCK *b;
+	int i, n, in, readed;
+
+	if (NULL == handler || offset < 0 || len < 0)
+		return -1;
+	if (offset >= handler->total_size || len == 0)
+		return 0;
+	i = block_at(handler, offset);
+	if (i == -1)
+		return -1;
+
+	readed = 0;
+	for (; i < handler->block_num && readed < len; i++) {
+		b = handler->index[i];
+		in = offset + readed - b->offset;
+		n = b->current_write_count - in;
+		if (n > len - readed)
+			n = len - readed;
+		if (n <= 0)
+			continue;
+		memcpy(data + readed, b->data + in, n);
+		readed += n;
 	}
+	return readed;
 }
 
 /*
@@ -144,31 +1013,22 @@ mwrite(MFILE *handler, const char *data, int len)
 	handler->total_size += len;
 	while (writed < len) {
 		if (handler->is_full) {
-			new_block = handler->alloc_fun(sizeof(DATA_BLOCK));
-			if (NULL == new_block) {
-				fprintf(stderr, "alloc_fun data_block error\n");
-				return -1;
-			}
-#ifdef MALLOC_DEBUG
-++total_malloc;
-#endif
-			memset(new_block, 0, sizeof(DATA_BLOCK));
-			new_block->data = (char *)handler->alloc_fun(handler->DATA_BLOCK_SIZE);
-			if (NULL == new_block->data) {
-				fprintf(stderr, "alloc_fun data buffer error\n");
-				handler->free_fun(new_block);
-				/*#ifdef MALLOC_DEBUG
-				++total_free;
-				#endif*/
+			/* a full spilled block leaves the RSS, its pages stay in
+			the page cache and reads fault them back */
+			current_block = handler->current_write_p;
+			if (current_block != NULL && current_block->spill != NULL)
+				spill_dontneed(current_block, handler->DATA_BLOCK_SIZE);
+			new_block = block_new(handler);
+			if (NULL == new_block)
 				return -1;
-			}
-#ifdef MALLOC_DEBUG
-++total_malloc;
-#endif
 			handler->block_num++;
 			handler->current_write_p = new_block;
 			TAILQ_INSERT_TAIL(&handler->head, new_block, entries);
+			index_add(handler, new_block);
 		}
+		if (handler->current_write_p->shared != NULL
+			&& block_unshare(handler) == -1)
+			return -1;
 		current_block = handler->current_write_p;
 		free_count = handler->DATA_BLOCK_SIZE - (current_block->current_write_count);
 		curr_p = current_block->data
@@ -215,21 +1075,13 @@ mwrite_head(MFILE *handler, const char *data, int len)
 		return -1;
 	}
 	handler->total_size += len;
-	new_block = handler->alloc_fun(sizeof(DATA_BLOCK));
-	if (NULL == new_block) {
-		fprintf(stderr, "alloc_fun data_block error\n");
-		return -1;
-	}
-	memset(new_block, 0, sizeof(DATA_BLOCK));
-	new_block->data = (char *)handler->alloc_fun(handler->DATA_BLOCK_SIZE);
-	if (NULL == new_block->data) {
-		fprintf(stderr, "alloc_fun data buffer error\n");
-		handler->free_fun(new_block);
+	new_block = block_new(handler);
+	if (NULL == new_block)
 		return -1;
-	}
 	handler->new_header_size += len;
 	handler->block_num++;
 	TAILQ_INSERT_HEAD(&handler->head, new_block, entries);
+	handler->index_ok = 0;
 	curr_p = new_block->data;
 	new_block->current_write_count = len;
 	new_block->data_len = len;
@@ -261,6 +1113,7 @@ mread(MFILE *handler, char *data, int len)
 		if (NULL == handler->current_read_p) {
 			return -1;
 		}
+		handler->current_read_p->current_read_count = 0;
 	}
 
 	int readed = 0;
@@ -277,6 +1130,7 @@ mread(MFILE *handler, char *data, int len)
 				break;
 			}
 			handler->current_read_p = new_block;
+			new_block->current_read_count = 0;
 		}
 
 		current_block = handler->current_read_p;
@@ -332,6 +1186,7 @@ mgetc(MFILE *handler)
 		if (handler->current_read_p == NULL) {
 			return 0;
 		}
+		handler->current_read_p->current_read_count = 0;
 	}
 	if (handler->is_empty) {
 		//next:
@@ -340,6 +1195,7 @@ mgetc(MFILE *handler)
 			return 0;
 		}
 		handler->current_read_p = new_block;
+		new_block->current_read_count = 0;
 	}
 	current_block = handler->current_read_p;
 	//could_read = (current_block->current_write_count)
@@ -361,67 +1217,260 @@ mgetc(MFILE *handler)
 	//}
 }
 
+/*
+* read_span()
+* @p: set to the unread data of the current block
+* Move the read position to a block with unread data.
+* Return the number of bytes at *p, 0 in the end
+*/
+static int
+read_span(MFILE *handler, char **p)
+{
+	DATA_BLOCK *b;
+
+	b = handler->current_read_p;
+	if (NULL == b) {
+		b = TAILQ_FIRST(&handler->head);
+		if (NULL == b)
+			return 0;
+		b->current_read_count = 0;
+		handler->current_read_p = b;
+		handler->is_empty = 0;
+	}
+	while (handler->is_empty || b->current_read_count >= b->current_write_count) {
+		b = TAILQ_NEXT(b, entries);
+		if (NULL == b)
+			return 0;
+		b->current_read_count = 0;
+		handler->current_read_p = b;
+		handler->is_empty = 0;
+	}
+	*p = b->data + b->current_read_count;
+	return b->current_write_count - b->current_read_count;
+}
+
+static void
+read_skip(MFILE *handler, int len)
+{
+	DATA_BLOCK *b = handler->current_read_p;
+
+	b->current_read_count += len;
+	handler->is_empty = b->current_read_count == b->current_write_count;
+}
+
 /*
 * mread_line()
 * @handler: handler of savadata
 * @buf: the data you want read
 * @n: length of data buffer
+* The line keeps its "\n" or "\r\n". A bare '\r' ends the line, the next
+* char is kept in ccache for the next line; a '\r' in the end gets a '\n'.
+* Lines longer than n - 2 are returned in pieces. buf is '\0' terminated.
 * Upon successful completion mread_line() return size that you readed.
 * in the end, 0 is returned
 */
 int
 mread_line(MFILE *handler, char *buf, int n)
 {
-	int r;
+	char *p, *nl, *cr;
+	int r, room, len;
+	char c;
 
-	if (NULL == handler)
+	if (NULL == handler || n < 3)
 		return 0;
 	r = 0;
-	buf[n-1] = '\0';
-	n -= 2;
-	if (n != 0) {
-		char *d = buf;
-		do {
-			if ('\n' == handler->ccache) {
-				*d = mgetc(handler);
-			} else {
-				*d = handler->ccache;
-				handler->ccache = '\r';
+	room = n - 2;
+	/* char read after a bare '\r' */
+	if (handler->ccache != '\n') {
+		c = handler->ccache;
+		handler->ccache = '\n';
+		if (c == '\0') {
+			buf[0] = '\0';
+			return 0;
+		}
+		buf[r++] = c;
+		if (c == '\r')
+			goto got_cr;
+	}
+
+	while (r < room) {
+		len = read_span(handler, &p);
+		if (len == 0)
+			break;
+		if (len > room - r)
+			len = room - r;
+		nl = memchr(p, '\n', len);
+		if (nl != NULL)
+			len = nl - p + 1;
+		cr = memchr(p, '\r', len);
+		if (cr != NULL)
+			len = cr - p + 1;
+		memcpy(buf + r, p, len);
+		read_skip(handler, len);
+		r += len;
+		if (cr != NULL)
+			goto got_cr;
+		if (nl != NULL)
+			break;
+	}
+	buf[r] = '\0';
+	return r;
+
+got_cr:
+	len = read_span(handler, &p);
+	if (len == 0) {
+		buf[r++] = '\n';
+	} else if (*p == '\n') {
+		buf[r++] = '\n';
+		read_skip(handler, 1);
+	} else {
+		handler->ccache = *p;
+		read_skip(handler, 1);
+	}
+	buf[r] = '\0';
+	return r;
+}
+
+/*
+* mread_line_view()
+* @line: set to the line, not '\0' terminated
+* @buf, @n: used as mread_line() when the line is not inside one block
+* Like mread_line(), but a line inside one block is not copied: *line
+* points into the block and stays valid until mclose().
+* Upon successful completion mread_line_view() return the line length.
+* in the end, 0 is returned
+*/
+int
+mread_line_view(MFILE *handler, char **line, char *buf, int n)
+{
+	char *p, *nl, *cr;
+	int len;
+
+	if (NULL == handler)
+		return 0;
+	if (handler->ccache == '\n') {
+		len = read_span(handler, &p);
+		nl = len > 0 ? memchr(p, '\n', len) : NULL;
+		if (nl != NULL) {
+			len = nl - p + 1;
+			cr = memchr(p, '\r', len);
+			/* "\r\n" is fine, a bare '\r' ends the line earlier */
+			if (NULL == cr || cr == nl - 1) {
+				read_skip(handler, len);
+				*line = p;
+				return len;
 			}
-			if (*d == '\r') {
-				handler->ccache = mgetc(handler);
-				if ( '\0' == handler->ccache ) {
-					*(++d) = '\n';
-					*(++d) = '\0';
-					r = d - buf;
-					break;
-				}
-				else if ('\n' != handler->ccache) {
-					d++;
-					r = d - buf;
-					break;
-				}
-				else {
-					d++;
-					*d = handler->ccache;
-					d++;
-					r = d - buf;
-					break;
-				}
-			} else if (*d == '\n') {
-				d++;
-				r = d - buf;
-				break;
-			} else if (*d == 0) {
-				r = d - buf;
+		}
+	}
+	*line = buf;
+	return mread_line(handler, buf, n);
+}
+
+/*
+* write_batch()
+* One write from pos: a run of spilled blocks with sendfile() (splice()
+* to a pipe), or up to MFILE_IOV_MAX memory blocks with writev()
+* (vmsplice() to a pipe).
+* @splice_flags: SPLICE_F_NONBLOCK for a non-blocking pipe, splice()
+*                does not look at O_NONBLOCK
+* Return the bytes written, or -1 with errno set
+*/
+static ssize_t
+write_batch(MFILE *handler, int fd, int pos, int to_pipe, int splice_flags)
+{
+	struct iovec iov[MFILE_IOV_MAX];
+	DATA_BLOCK *b;
+	DATA_BLOCK *owner;
+	MSPILL *spill;
+	off_t off;
+	int i, in, n_iov, len;
+
+	i = block_at(handler, pos);
+	if (i == -1) {
+		errno = ENOMEM;
+		return -1;
+	}
+	b = handler->index[i];
+	in = pos - b->offset;
+	owner = b->shared != NULL ? b->shared : b;
+	if (owner->spill != NULL) {
+		spill = owner->spill;
+		off = owner->spill_off + (b->data - owner->data) + in;
+		len = b->current_write_count - in;
+		/* spilled blocks are usually adjacent in the file */
+		for (i++; i < handler->block_num; i++) {
+			b = handler->index[i];
+			owner = b->shared != NULL ? b->shared : b;
+			if (owner->spill != spill
+				|| owner->spill_off + (b->data - owner->data) != off + len)
 				break;
-			}
-			d++;
-		} while (--n > 0);
+			len += b->current_write_count;
+		}
+		if (to_pipe)
+			return splice(spill->fd, &off, fd, NULL, len,
+				SPLICE_F_MOVE | splice_flags);
+		return sendfile(fd, spill->fd, &off, len);
 	}
 
-	/* return the position that the string ends.*/
-	return (r);
+	n_iov = 0;
+	for (; i < handler->block_num && n_iov < MFILE_IOV_MAX; i++) {
+		b = handler->index[i];
+		owner = b->shared != NULL ? b->shared : b;
+		if (owner->spill != NULL)
+			break;
+		if (b->current_write_count > in) {
+			iov[n_iov].iov_base = b->data + in;
+			iov[n_iov].iov_len = b->current_write_count - in;
+			n_iov++;
+		}
+		in = 0;
+	}
+	if (to_pipe)
+		return vmsplice(fd, iov, n_iov, splice_flags);
+	return writev(fd, iov, n_iov);
+}
+
+/*
+* mwrite_fd()
+* @handler: handler of savadata
+* @fd: blocking or non-blocking file, pipe or socket
+* @pos: cursor, bytes of handler already written; start with 0
+* @flags: MWRITE_SPLICE, vmsplice() to a pipe instead of copying
+* Write from *pos to the end in batches, resuming after short writes.
+* With MWRITE_SPLICE the pipe refers to the blocks' pages, so handler
+* must stay open and unchanged until the reader has drained the pipe.
+* Upon successful completion mwrite_fd() return 1.
+* 0 is returned when a non-blocking fd is full, call it again with the
+* same *pos once fd is writable.
+* Otherwise, -1 is returned
+*/
+int
+mwrite_fd(MFILE *handler, int fd, int *pos, int flags)
+{
+	struct stat st;
+	ssize_t retval;
+	int to_pipe, splice_flags;
+
+	if (NULL == handler || NULL == pos || *pos < 0)
+		return -1;
+	to_pipe = (flags & MWRITE_SPLICE) && fstat(fd, &st) == 0
+		&& S_ISFIFO(st.st_mode);
+	splice_flags = to_pipe && (fcntl(fd, F_GETFL) & O_NONBLOCK)
+		? SPLICE_F_NONBLOCK : 0;
+	while (*pos < handler->total_size) {
+		retval = write_batch(handler, fd, *pos, to_pipe, splice_flags);
+		if (retval < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		if (retval == 0)
+			return -1;
+		*pos += retval;
+	}
+	return 1;
 }
 
 /*
@@ -434,36 +1483,15 @@ mread_line(MFILE *handler, char *buf, int n)
 int
 mwrite_file(MFILE *handler, int fd)
 {
-	const int MAX_BLOCK_NUMBER = 1024;
-	struct iovec iov[MAX_BLOCK_NUMBER];
-	int n_iov;
-	DATA_BLOCK *dbnp;
-	int file_size;
-	int retval;
+	int pos = 0;
 
 	if (NULL == handler) {
 		return -1;
 	}
-	n_iov = 0;
-	dbnp = NULL;
-	file_size = 0;
-	TAILQ_FOREACH(dbnp, &(handler->head), entries) {
-		iov[n_iov].iov_base = dbnp->data;
-		iov[n_iov].iov_len = dbnp->data_len < 0 ? 0 : dbnp->data_len;
-		n_iov++;
-		file_size += dbnp->data_len;
-		if (n_iov >= MAX_BLOCK_NUMBER)
-			return -1;
-	}
-	if (file_size == 0) {
-		return 0;
-	}
-	retval = writev(fd, iov, n_iov);
-	if (retval < 0) {
+	if (mwrite_fd(handler, fd, &pos, 0) == -1 && pos == 0) {
 		return -1;
-	} else {
-		return retval;
 	}
+	return pos;
 }
 
 /*
@@ -485,28 +1513,68 @@ unsigned int mfile_new_header_size( MFILE *handler )
 	return handler->new_header_size;
 }
 
+/*
+* mfile_copy()
+* Append [start, end) of src to dest, sharing src's blocks (mfile_slice()).
+* src's read position is not changed.
+*/
 int mfile_copy( MFILE* dest, MFILE* src, unsigned int start, unsigned int end )
 {
-	char buffer[1024];
-	mseek_pos( src, start );
-
-	unsigned int i = start;
-	unsigned int j = 0;
-	int ret;
-	while ( i < end ) {
-		j = end - i;
-		j = j<1024 ? j : 1024;
-		ret = mread( src, buffer, j );
-		if ( ret <= 0 ) {
-			return -1;
-		}
-		else {
-			mwrite( dest, buffer, ret );
-			if ( ret < 1024 ) {
-				break;
-			}
-		}
-		i += j;
+	if ( start < end && mfile_slice( dest, src, start, end ) <= 0 ) {
+		return -1;
 	}
 	return end-start;
 }
+
+/*
+* mfile_slice()
+* @dest: the slice is appended to dest
+* @src: may be closed or written to afterwards, dest keeps the data
+* @start, @end: range [start, end) of src, end is cut to msize(src)
+* dest shares src's blocks instead of copying them; a shared block is
+* copied only when mwrite() appends to dest's last slice.
+* Blocks are reference counted atomically, so dest and src may be used by
+* different threads (with a MPOOL_SHARED pool if src uses a pool).
+* Upon successful completion mfile_slice() return the number of bytes
+* appended. Otherwise, -1 is returned
+*/
+int
+mfile_slice(MFILE *dest, MFILE *src, unsigned int start, unsigned int end)
+{
+	DATA_BLOCK *b;
+	DATA_BLOCK *v;
+	unsigned int pos;
+	int i, in, n;
+
+	if (NULL == dest || NULL == src || start > end)
+		return -1;
+	if (end > (unsigned int)src->total_size)
+		end = src->total_size;
+	if (start >= end)
+		return 0;
+	i = block_at(src, start);
+	if (i == -1)
+		return -1;
+
+	for (pos = start; pos < end && i < src->block_num; i++) {
+		b = src->index[i];
+		in = pos - b->offset;
+		n = b->current_write_count - in;
+		if (n > (int)(end - pos))
+			n = end - pos;
+		if (n <= 0)
+			continue;
+		v = block_view(dest, b, in, n);
+		if (NULL == v)
+			return -1;
+		dest->block_num++;
+		dest->total_size += n;
+		dest->current_write_p = v;
+		TAILQ_INSERT_TAIL(&dest->head, v, entries);
+		index_add(dest, v);
+		pos += n;
+	}
+	/* room left: the next mwrite() copies the slice into its own block */
+	dest->is_full = dest->current_write_p->current_write_count >= dest->DATA_BLOCK_SIZE;
+	return pos - start;
+}
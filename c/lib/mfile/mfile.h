@@ -2,21 +2,102 @@
 #ifndef _MFILE_H_
 #define _MFILE_H_
 
+#include <pthread.h>
+#include <sys/types.h>
 #include "queue.h"
 
 #define DEFAULT_DATA_BLOCK_SIZE  8888
+#define DEFAULT_SLAB_BLOCKS  64
+#define MWRITE_SPLICE  0x1 /* mwrite_fd(): vmsplice() when fd is a pipe */
+#define MSPILL_WINDOW  (64 * 1024 * 1024) /* spill file is mapped in windows this big */
 typedef void *USER_ALLOCER(size_t);
 typedef void USER_FREER(void *);
 
+struct mpool;
+
+/* one mapping of the spill file, blocks are packed into it back to back */
+typedef struct mspill_map
+{
+	char *base;
+	size_t len;
+	int refs; /* the MSPILL while it is the current window, and its blocks */
+} MSPILL_MAP;
+
+/* unlinked temp file holding the blocks written past the spill threshold */
+typedef struct mspill
+{
+	int fd;
+	int refs; /* the MFILE and its blocks mapped from the file */
+	size_t map_size; /* MSPILL_WINDOW, at least one block, in whole pages */
+	MSPILL_MAP *map; /* window new blocks are taken from */
+	off_t map_off; /* file offset of map */
+	off_t size; /* end of the last block */
+} MSPILL;
+
 typedef struct data_block
 {
 	int data_len;
 	char *data;
 	int current_write_count;
-	int current_read_count;
+	int current_read_count; /* valid for the handler's current_read_p only */
+	int offset; /* position of data[0] in the MFILE */
+	struct mpool *pool; /* NULL: allocated by the MFILE's alloc_fun */
+	USER_FREER *free_fun; /* frees a block not from a pool */
+	int refs; /* MFILEs and slices holding this block's data */
+	struct data_block *shared; /* slice: data points into this block */
+	MSPILL *spill; /* not NULL: data is mapped from spill->fd at spill_off */
+	MSPILL_MAP *spill_map; /* the window data lies in */
+	off_t spill_off;
 	TAILQ_ENTRY(data_block) entries;
 } DATA_BLOCK;
 
+/* block pool statistics */
+typedef struct mpool_stat
+{
+	unsigned long slabs; /* slabs allocated */
+	unsigned long blocks; /* blocks carved from slabs */
+	unsigned long in_use; /* blocks held by MFILEs */
+	unsigned long gets; /* blocks handed out */
+	unsigned long reuses; /* gets served by a recycled block */
+} MPOOL_STAT;
+
+#define MPOOL_SHARED  0x1 /* pool is used by several threads, take a lock */
+
+/*
+ * Block pool: DATA_BLOCK header and payload are carved together from slabs
+ * and recycled on mclose() instead of being freed.
+ */
+typedef struct mpool
+{
+	int block_size;
+	int slab_blocks;
+	int flags;
+	pthread_mutex_t lock;
+	DATA_BLOCK *free_list; /* linked through entries.tqe_next */
+	void *slabs; /* each slab starts with a pointer to the next one */
+	MPOOL_STAT stat;
+} MPOOL;
+
+/*
+ * Stream mode: one thread writes with mstream_write(), another reads with
+ * mstream_read() at the same time. Block write counts and links are
+ * published with atomics; the lock is only taken to sleep and wake.
+ */
+typedef struct mstream
+{
+	int closed; /* mstream_end() was called */
+	int max_blocks; /* blocks in flight, 0: no limit */
+	int made; /* blocks created, writer only */
+	int freed; /* blocks released by the reader */
+	int read_waiting;
+	int write_waiting;
+	pthread_mutex_t lock;
+	pthread_cond_t readable;
+	pthread_cond_t writable;
+} MSTREAM;
+
+#define MSTREAM_NOWAIT  0x1 /* mstream_read(): don't wait for data */
+
 TAILQ_HEAD(mfile_head, data_block);
 
 /* mfile's handler */
@@ -35,20 +116,42 @@ typedef struct mfile
 	char ccache;
 	USER_ALLOCER *alloc_fun;
 	USER_FREER *free_fun;
+	MPOOL *pool; /* NULL: blocks come from alloc_fun */
+	DATA_BLOCK **index; /* blocks in order, for binary search on offset */
+	int index_cap;
+	int index_ok; /* 0: rebuild index before use (after mwrite_head) */
+	int spill_threshold; /* 0: never spill */
+	char *spill_dir;
+	MSPILL *spill;
+	MSTREAM *stream; /* not NULL: opened by mopen_stream() */
 } MFILE;
 
+MPOOL *mpool_create(int block_size, int slab_blocks, int flags);
+void mpool_destroy(MPOOL *pool);
+void mpool_stat(MPOOL *pool, MPOOL_STAT *stat);
+
 MFILE *mopen(int data_block_size, USER_ALLOCER *af, USER_FREER *fe);
+MFILE *mopen_pool(MPOOL *pool);
+int mset_spill(MFILE *handler, int threshold, const char *dir);
+MFILE *mopen_stream(MPOOL *pool, int max_blocks);
+int mstream_write(MFILE *handler, const char *data, int len);
+void mstream_end(MFILE *handler);
+int mstream_read(MFILE *handler, char *data, int len, int flags);
 void mclose(MFILE *handler);
 int mwrite(MFILE *handler, const char *data, int len);
 int mwrite_head(MFILE *handler, const char *data, int len);
 int mread(MFILE *handler, char *data, int len);
+int mpread(MFILE *handler, char *data, int len, int offset);
 void mseek(MFILE *handler);
 void mseek_pos(MFILE *handler, int pos);
 char mgetc(MFILE *handler);
 int mread_line(MFILE *handler, char *buf, int n);
+int mread_line_view(MFILE *handler, char **line, char *buf, int n);
 int mwrite_file(MFILE *handler, int fd);
+int mwrite_fd(MFILE *handler, int fd, int *pos, int flags);
 int msize(MFILE *handler);
 unsigned int mfile_new_header_size( MFILE *handler );
 int mfile_copy(MFILE* dest, MFILE* src, unsigned int start, unsigned int end);
+int mfile_slice(MFILE *dest, MFILE *src, unsigned int start, unsigned int end);
 
 #endif
@@ -0,0 +1,154 @@
+/*
+ * mfile benchmark: mopen + mwrite + mclose per message,
+ * blocks from alloc_fun (malloc/free) versus a block pool;
+ * then the same bytes through a stream MFILE between two threads.
+ *
+ * Build:
+ *  make -f linux.mk mfile_bench
+ *
+ * Exec:
+ *  ./mfile_bench [messages] [message bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "mfile.h"
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* write one message in 1 KB pieces, like a body received from the network */
+static int
+message(MFILE *mfp, const char *buf, int size)
+{
+	int off, n;
+
+	for (off = 0; off < size; off += n) {
+		n = size - off < 1024 ? size - off : 1024;
+		if (mwrite(mfp, buf, n) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+struct producer
+{
+	MFILE *mfp;
+	int num;
+	int size;
+};
+
+static void *
+produce(void *arg)
+{
+	struct producer *p = arg;
+	char buf[1024];
+	int i, off, n;
+
+	memset(buf, 'x', sizeof(buf));
+	for (i = 0; i < p->num; i++) {
+		for (off = 0; off < p->size; off += n) {
+			n = p->size - off < 1024 ? p->size - off : 1024;
+			if (mstream_write(p->mfp, buf, n) != 1)
+				return NULL;
+		}
+	}
+	mstream_end(p->mfp);
+	return NULL;
+}
+
+/* writer thread -> stream MFILE -> reader, at most 64 blocks in flight */
+static int
+stream(int num, int size)
+{
+	struct producer p;
+	pthread_t tid;
+	MPOOL *pool;
+	MPOOL_STAT st;
+	char buf[4096];
+	double t0, t1;
+	long total = 0;
+	int n;
+
+	pool = mpool_create(0, 0, MPOOL_SHARED);
+	p.mfp = mopen_stream(pool, 64);
+	p.num = num;
+	p.size = size;
+	if (NULL == p.mfp)
+		return -1;
+
+	t0 = now_sec();
+	pthread_create(&tid, NULL, produce, &p);
+	while ((n = mstream_read(p.mfp, buf, sizeof(buf), 0)) > 0)
+		total += n;
+	pthread_join(tid, NULL);
+	t1 = now_sec();
+	if (n == -1 || total != (long)num * size)
+		return -1;
+
+	mpool_stat(pool, &st);
+	printf("stream:      %.3fs, %.0f MB/s, %lu slabs for %lu blocks written\n",
+		t1 - t0, total / (t1 - t0) / (1024 * 1024), st.slabs, st.gets);
+	mclose(p.mfp);
+	mpool_destroy(pool);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int num = argc > 1 ? atoi(argv[1]) : 200000;
+	int size = argc > 2 ? atoi(argv[2]) : 64 * 1024;
+	MPOOL *pool;
+	MPOOL_STAT st;
+	MFILE *mfp;
+	char buf[1024];
+	double t0, t1, t2;
+	int i;
+
+	memset(buf, 'x', sizeof(buf));
+
+	t0 = now_sec();
+	for (i = 0; i < num; i++) {
+		mfp = mopen(0, NULL, NULL);
+		if (NULL == mfp || message(mfp, buf, size) == -1)
+			return 1;
+		mclose(mfp);
+	}
+	t1 = now_sec();
+
+	pool = mpool_create(0, 0, 0);
+	if (NULL == pool)
+		return 1;
+	for (i = 0; i < num; i++) {
+		mfp = mopen_pool(pool);
+		if (NULL == mfp || message(mfp, buf, size) == -1)
+			return 1;
+		mclose(mfp);
+	}
+	t2 = now_sec();
+
+	mpool_stat(pool, &st);
+	printf("messages: %d x %d bytes, block %d\n", num, size, DEFAULT_DATA_BLOCK_SIZE);
+	printf("malloc/free: %.3fs, %.0f messages/s\n", t1 - t0, num / (t1 - t0));
+	printf("block pool:  %.3fs, %.0f messages/s\n", t2 - t1, num / (t2 - t1));
+	printf("pool: %lu slabs, %lu blocks, %lu in use, %lu gets, %lu reused\n",
+		st.slabs, st.blocks, st.in_use, st.gets, st.reuses);
+	mpool_destroy(pool);
+
+	if (stream(num, size) == -1) {
+		fprintf(stderr, "stream fail\n");
+		return 1;
+	}
+	return 0;
+}
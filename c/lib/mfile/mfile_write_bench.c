@@ -0,0 +1,133 @@
+/*
+ * mwrite_fd() throughput: one large MFILE written to a pipe and a socket
+ * drained by another thread.
+ *
+ * Build:
+ *  make -f linux.mk mfile_write_bench
+ *
+ * Exec:
+ *  ./mfile_write_bench [MB] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "mfile.h"
+
+struct drain
+{
+	int fd;
+	long bytes;
+};
+
+static double
+now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+drain(void *arg)
+{
+	struct drain *d = arg;
+	static char buf[256 * 1024];
+	ssize_t n;
+
+	while ((n = read(d->fd, buf, sizeof(buf))) > 0)
+		d->bytes += n;
+	return NULL;
+}
+
+/* write mfp rounds times to fd[1], fd[0] is drained by a thread */
+static int
+run(const char *name, MFILE *mfp, int fd[2], int flags, int rounds, int nonblock)
+{
+	struct drain d;
+	struct pollfd pfd;
+	pthread_t tid;
+	double t0, t1;
+	int i, pos, ret;
+
+	d.fd = fd[0];
+	d.bytes = 0;
+	if (nonblock)
+		fcntl(fd[1], F_SETFL, fcntl(fd[1], F_GETFL) | O_NONBLOCK);
+	pthread_create(&tid, NULL, drain, &d);
+
+	t0 = now_sec();
+	for (i = 0; i < rounds; i++) {
+		pos = 0;
+		while ((ret = mwrite_fd(mfp, fd[1], &pos, flags)) == 0) {
+			pfd.fd = fd[1];
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, -1);
+		}
+		if (ret == -1) {
+			perror(name);
+			return -1;
+		}
+	}
+	close(fd[1]);
+	pthread_join(tid, NULL);
+	t1 = now_sec();
+	close(fd[0]);
+
+	if (d.bytes != (long)msize(mfp) * rounds) {
+		fprintf(stderr, "%s: read %ld bytes\n", name, d.bytes);
+		return -1;
+	}
+	printf("%-28s %.3fs, %.0f MB/s\n", name, t1 - t0,
+		d.bytes / (t1 - t0) / (1024 * 1024));
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	int mb = argc > 1 ? atoi(argv[1]) : 64;
+	int rounds = argc > 2 ? atoi(argv[2]) : 10;
+	MFILE *mem, *spill;
+	char buf[4096];
+	int fd[2];
+	int i;
+
+	memset(buf, 'x', sizeof(buf));
+	mem = mopen(0, NULL, NULL);
+	spill = mopen(0, NULL, NULL);
+	if (NULL == mem || NULL == spill || mset_spill(spill, 1, NULL) == -1)
+		return 1;
+	for (i = 0; i < mb * 256; i++) {
+		if (mwrite(mem, buf, sizeof(buf)) == -1
+			|| mwrite(spill, buf, sizeof(buf)) == -1)
+			return 1;
+	}
+	printf("message: %d MB, %d blocks of %d bytes, %d rounds\n",
+		mb, mem->block_num, DEFAULT_DATA_BLOCK_SIZE, rounds);
+
+	if (pipe(fd) == -1 || run("pipe writev", mem, fd, 0, rounds, 0) == -1)
+		return 1;
+	if (pipe(fd) == -1 || run("pipe vmsplice", mem, fd, MWRITE_SPLICE, rounds, 0) == -1)
+		return 1;
+	if (pipe(fd) == -1 || run("pipe splice (spilled)", spill, fd, MWRITE_SPLICE, rounds, 0) == -1)
+		return 1;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == -1
+		|| run("socket writev, non-blocking", mem, fd, 0, rounds, 1) == -1)
+		return 1;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == -1
+		|| run("socket sendfile (spilled)", spill, fd, 0, rounds, 1) == -1)
+		return 1;
+
+	mclose(mem);
+	mclose(spill);
+	return 0;
+}
@@ -1,14 +1,202 @@
+#define _GNU_SOURCE // O_DIRECT
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <zlib.h>
 #include "scdb.h"
 #include "utils.h"
 
+static struct scdb_cache *cache_new()
+{
+    struct scdb_cache *cc;
+    void *mem;
+    int i;
+
+    cc = (struct scdb_cache *)calloc(1, sizeof(struct scdb_cache));
+    if (!cc)
+        return NULL;
+    // O_DIRECT 要求缓冲区按块对齐
+    if (posix_memalign(&mem, SCDB_CACHE_BLOCK, (size_t)SCDB_CACHE_BLOCK * SCDB_CACHE_SETS * SCDB_CACHE_WAYS))
+    {
+        free(cc);
+        return NULL;
+    }
+
+    cc->mem = (char *)mem;
+    for (i = 0; i < SCDB_CACHE_SETS * SCDB_CACHE_WAYS; ++i)
+        cc->b[i].buf = cc->mem + (size_t)i * SCDB_CACHE_BLOCK;
+
+    return cc;
+}
+
+static void cache_free(struct scdb_cache *cc)
+{
+    free(cc->mem);
+    free(cc);
+}
+
+/**
+ * @brief   查找块号为 no 的缓存块
+ */
+static struct scdb_cblock *cache_find(struct scdb_cache *cc, uint64_t no)
+{
+    struct scdb_cblock *b = cc->b + (no % SCDB_CACHE_SETS) * SCDB_CACHE_WAYS;
+    int i;
+
+    for (i = 0; i < SCDB_CACHE_WAYS; ++i)
+        if (b[i].no == no + 1)
+            return b + i;
+    return NULL;
+}
+
+/**
+ * @brief   为块号 no 选择要替换的缓存块: 组内的空块或最久未访问的块
+ */
+static struct scdb_cblock *cache_victim(struct scdb_cache *cc, uint64_t no)
+{
+    struct scdb_cblock *b = cc->b + (no % SCDB_CACHE_SETS) * SCDB_CACHE_WAYS;
+    struct scdb_cblock *v = b;
+    int i;
+
+    for (i = 0; i < SCDB_CACHE_WAYS; ++i)
+    {
+        if (!b[i].no)
+            return b + i;
+        if (b[i].tick < v->tick)
+            v = b + i;
+    }
+    return v;
+}
+
+/**
+ * @brief   把 n 个连续的块 (从块号 no 开始) 读入 v[], 一次 preadv
+ * @return 0:成功, -1:失败
+ * @note preadv 读到的字节数不够时 (FUSE 等) 逐块补读
+ */
+static int cache_fill(struct scdb *c, struct scdb_cblock **v, int n, uint64_t no)
+{
+    struct scdb_cache *cc = c->cache;
+    struct iovec iov[SCDB_CACHE_SETS];
+    uint64_t off = no * SCDB_CACHE_BLOCK, got, have, want;
+    ssize_t r;
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        v[i]->no = 0;
+        iov[i].iov_base = v[i]->buf;
+        iov[i].iov_len = SCDB_CACHE_BLOCK;
+    }
+
+    do
+        r = preadv(c->fd, iov, n, (off_t)off);
+    while ((r == -1) && (errno == EINTR));
+    ++cc->reads;
+    if (r == -1)
+        return -1;
+    got = r;
+
+    for (i = 0; i < n; ++i, off += SCDB_CACHE_BLOCK)
+    {
+        want = (c->size > off) ? c->size - off : 0;
+        if (want > SCDB_CACHE_BLOCK)
+            want = SCDB_CACHE_BLOCK;
+        have = (got > (uint64_t)i * SCDB_CACHE_BLOCK) ? got - (uint64_t)i * SCDB_CACHE_BLOCK : 0;
+        if (have > want)
+            have = want;
+
+        while (have < want)
+        {
+            do
+                r = pread(c->fd, v[i]->buf + have, want - have, (off_t)(off + have));
+            while ((r == -1) && (errno == EINTR));
+            ++cc->reads;
+            if (r <= 0)
+                return -1;
+            have += r;
+        }
+
+        v[i]->no = no + i + 1;
+        v[i]->len = (uint32_t)have;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   从块缓存读取 [pos, pos + len), 连续未命中的块合并成一次读
+ * @return 0:成功, -1:失败
+ */
+static int cache_read(struct scdb *c, char *buf, unsigned int len, uint64_t pos)
+{
+    struct scdb_cache *cc = c->cache;
+    struct scdb_cblock *v[SCDB_CACHE_SETS], *b;
+    uint64_t no, last, off, end = pos + len;
+    unsigned int n, from, cnt;
+    int i;
+
+    if (!len)
+        return 0;
+
+    no = pos / SCDB_CACHE_BLOCK;
+    last = (end - 1) / SCDB_CACHE_BLOCK;
+    while (no <= last)
+    {
+        b = cache_find(cc, no);
+        if (b)
+        {
+            ++cc->hits;
+            v[0] = b;
+            n = 1;
+        }
+        else
+        {
+            // 组数以内的连续块落在不同的组, 不会互相替换
+            for (n = 0; no + n <= last && n < SCDB_CACHE_SETS; ++n)
+            {
+                if (n && cache_find(cc, no + n))
+                    break;
+                v[n] = cache_victim(cc, no + n);
+            }
+            cc->misses += n;
+            if (cache_fill(c, v, n, no) == -1)
+                return -1;
+        }
+
+        for (i = 0; i < (int)n; ++i, ++no)
+        {
+            b = v[i];
+            b->tick = ++cc->tick;
+            off = no * SCDB_CACHE_BLOCK;
+            from = (pos > off) ? (unsigned int)(pos - off) : 0;
+            cnt = ((end < off + SCDB_CACHE_BLOCK) ? (unsigned int)(end - off) : SCDB_CACHE_BLOCK) - from;
+            if (from + cnt > b->len)
+                return -1;
+            memcpy(buf, b->buf + from, cnt);
+            buf += cnt;
+        }
+    }
+
+    return 0;
+}
+
+static void zcache_free(struct scdb_zcache *zc)
+{
+    int i;
+
+    for (i = 0; i < SCDB_ZCACHE_SLOTS; ++i)
+        if (zc->s[i].buf)
+            free(zc->s[i].buf);
+    free(zc);
+}
+
 void scdb_free(struct scdb *c)
 {
     if (c->map)
@@ -16,6 +204,16 @@ void scdb_free(struct scdb *c)
         munmap(c->map, c->size);
         c->map = 0;
     }
+    if (c->cache)
+    {
+        cache_free(c->cache);
+        c->cache = 0;
+    }
+    if (c->zcache)
+    {
+        zcache_free(c->zcache);
+        c->zcache = 0;
+    }
 }
 
 void scdb_findstart(struct scdb *c)
@@ -27,31 +225,83 @@ void scdb_findstart(struct scdb *c)
  * @brief   初始化 struct scdb 结构
  * @param c 指向 struct scdb 对象的指针
  * @param fd    cdb 文件的句柄
+ * @note 根据文件开头的 magic 识别 32 位 (djb cdb) 或 64 位格式
  */
 void scdb_init(struct scdb *c, int fd)
+{
+    scdb_init_flags(c, fd, 0);
+}
+
+/**
+ * @brief   同 scdb_init, 可指定映射方式
+ * @param oflags    SCDB_O_* 组合:
+ *                  SCDB_O_POPULATE 映射时预读全部页面 (MAP_POPULATE)
+ *                  SCDB_O_WILLNEED madvise(MADV_WILLNEED), 异步预读
+ *                  SCDB_O_RANDOM   madvise(MADV_RANDOM), 关闭顺序预读
+ *                  SCDB_O_NOMMAP   不映射, 通过块缓存 pread
+ *                  SCDB_O_DIRECT   fd 以 O_DIRECT 打开, 同 SCDB_O_NOMMAP
+ * @note 映射失败 (如超过地址空间) 时同样退回块缓存; 调用前 c->map/c->cache/c->zcache 须为 0 或有效值
+ */
+void scdb_init_flags(struct scdb *c, int fd, int oflags)
 {
     struct stat st;
     char *x;
+    char buf[SCDB64_PREAMBLE];
+    int mflags = MAP_SHARED;
 
     scdb_free(c);
     scdb_findstart(c);
     c->fd = fd;
+    c->fmt = SCDB_FMT_32;
+    c->flags = 0;
+    c->fpos = 0;
+    c->fblocks = 0;
+    c->fk = 0;
+    c->zpos = 0;
+
+    if (oflags & SCDB_O_DIRECT)
+        oflags |= SCDB_O_NOMMAP;
 
     if (fstat(fd, &st) == 0)
     {
-        if (st.st_size <= 0xffffffff)
+        c->size = st.st_size;
+        if (!(oflags & SCDB_O_NOMMAP) && (off_t)(size_t)st.st_size == st.st_size)
         {
-            x = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-            if (x + 1)
+#ifdef MAP_POPULATE
+            if (oflags & SCDB_O_POPULATE)
+                mflags |= MAP_POPULATE;
+#endif
+            x = mmap(0, st.st_size, PROT_READ, mflags, fd, 0);
+            if (x != MAP_FAILED)
             {
                 c->size = st.st_size;
                 c->map = x;
+                if (oflags & SCDB_O_WILLNEED)
+                    madvise(x, st.st_size, MADV_WILLNEED);
+                if (oflags & SCDB_O_RANDOM)
+                    madvise(x, st.st_size, MADV_RANDOM);
             }
         }
+        if (!c->map)
+            c->cache = cache_new();
+    }
+
+    if (scdb_read(c, buf, SCDB64_PREAMBLE, 0) == 0 && memcmp(buf, SCDB64_MAGIC, SCDB64_MAGIC_LEN) == 0)
+    {
+        c->fmt = SCDB_FMT_64;
+        uint64_unpack(buf + 8, &c->flags);
+        if (c->flags & SCDB_F_FILTER)
+        {
+            uint64_unpack(buf + SCDB64_OFF_FILTER_POS, &c->fpos);
+            uint64_unpack(buf + SCDB64_OFF_FILTER_BLOCKS, &c->fblocks);
+            uint32_unpack(buf + SCDB64_OFF_FILTER_K, &c->fk);
+        }
+        if (c->flags & SCDB_F_ZBLOCK)
+            uint64_unpack(buf + SCDB64_OFF_ZBLOCK_POS, &c->zpos);
     }
 }
 
-int scdb_read(struct scdb *c, char *buf, unsigned int len, uint32_t pos)
+int scdb_read(struct scdb *c, char *buf, unsigned int len, uint64_t pos)
 {
     if (c->map)
     {
@@ -59,21 +309,25 @@ int scdb_read(struct scdb *c, char *buf, unsigned int len, uint32_t pos)
             goto FMT;
         memcpy(buf, c->map + pos, len);
     }
+    else if (c->cache)
+    {
+        if (cache_read(c, buf, len, pos) == -1)
+            goto FMT;
+    }
     else
     {
-        if (lseek(c->fd, pos, SEEK_SET) == -1)
-            return -1;
         while (len > 0)
         {
-            int r;
+            ssize_t r;
             do
-                r = read(c->fd, buf, len);
+                r = pread(c->fd, buf, len, (off_t)pos);
             while ((r == -1) && (errno == EINTR));
             if (r == -1)
                 return -1;
             if (r == 0)
                 goto FMT;
             buf += r;
+            pos += r;
             len -= r;
         }
     }
@@ -84,10 +338,21 @@ FMT:
     return -1;
 }
 
-static int match(struct scdb *c, char *key, unsigned int len, uint32_t pos)
+/**
+ * @brief   比较 pos 处的 key, 按字节比较 (key 可以包含 '\0')
+ * @note 已映射时直接与映射区 memcmp, 不经过 scdb_read 拷贝
+ */
+static int match(struct scdb *c, char *key, unsigned int len, uint64_t pos)
 {
-    char buf[32];
-    int n;
+    char buf[64];
+    unsigned int n;
+
+    if (c->map)
+    {
+        if ((pos > c->size) || (c->size - pos < len))
+            return -1;
+        return memcmp(c->map + pos, key, len) == 0;
+    }
 
     while (len > 0)
     {
@@ -96,7 +361,7 @@ static int match(struct scdb *c, char *key, unsigned int len, uint32_t pos)
             n = len;
         if (scdb_read(c, buf, n, pos) == -1)
             return -1;
-        if (strncmp(buf, key, n))
+        if (memcmp(buf, key, n))
             return 0;
 
         pos += n;
@@ -107,46 +372,129 @@ static int match(struct scdb *c, char *key, unsigned int len, uint32_t pos)
     return 1;
 }
 
-int scdb_findnext(struct scdb *c, char *key, unsigned int len)
+/**
+ * @brief   读取 hash 值对应的 header: 表位置与槽数
+ */
+static int header_read(struct scdb *c, uint64_t h, uint64_t *hpos, uint64_t *hslots)
 {
-    char buf[8];
-    uint32_t pos;
+    char buf[16];
     uint32_t u;
 
-    if (!c->loop)
+    if (c->fmt == SCDB_FMT_64)
     {
-        u = scdb_hash(key, len);
-        if (scdb_read(c, buf, 8, (u << 3) & 2047) == -1)
+        if (scdb_read(c, buf, 16, SCDB64_PREAMBLE + ((h & 255) << 4)) == -1)
             return -1;
-        uint32_unpack(buf + 4, &c->hslots);
-        if (!c->hslots)
-            return 0;
-        uint32_unpack(buf, &c->hpos);
-        c->khash = u;
-        u >>= 8;
-        u %= c->hslots;
-        u <<= 3;
-        c->kpos = c->hpos + u;
+        uint64_unpack(buf, hpos);
+        uint64_unpack(buf + 8, hslots);
+    }
+    else
+    {
+        if (scdb_read(c, buf, 8, (h << 3) & 2047) == -1)
+            return -1;
+        uint32_unpack(buf, &u);
+        *hpos = u;
+        uint32_unpack(buf + 4, &u);
+        *hslots = u;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   读取 hash 表中 pos 处的槽: hash 值与记录位置
+ */
+static int slot_read(struct scdb *c, uint64_t pos, uint64_t *h, uint64_t *p)
+{
+    char buf[16];
+    uint32_t u;
+
+    if (c->fmt == SCDB_FMT_64)
+    {
+        if (scdb_read(c, buf, 16, pos) == -1)
+            return -1;
+        uint64_unpack(buf, h);
+        uint64_unpack(buf + 8, p);
+    }
+    else
+    {
+        if (scdb_read(c, buf, 8, pos) == -1)
+            return -1;
+        uint32_unpack(buf, &u);
+        *h = u;
+        uint32_unpack(buf + 4, &u);
+        *p = u;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   hash 对应的 filter 块在文件中的位置
+ */
+static uint64_t filter_pos(struct scdb *c, uint64_t h)
+{
+    return c->fpos + scdb_filter_block(c->fblocks, h) * SCDB_FILTER_BLOCK;
+}
+
+/**
+ * @brief   查询 filter
+ * @return 1:可能存在, 0:一定不存在, -1:读取失败
+ */
+static int filter_maybe(struct scdb *c, uint64_t h)
+{
+    char buf[SCDB_FILTER_BLOCK];
+    uint64_t pos = filter_pos(c, h);
+
+    if (c->map)
+    {
+        if ((pos > c->size) || (c->size - pos < SCDB_FILTER_BLOCK))
+            return -1;
+        return scdb_filter_test(c->map + pos, c->fk, h);
     }
 
+    if (scdb_read(c, buf, SCDB_FILTER_BLOCK, pos) == -1)
+        return -1;
+    return scdb_filter_test(buf, c->fk, h);
+}
+
+/**
+ * @brief   只查询 filter, 不查找记录
+ * @return 1:可能存在, 0:一定不存在, -1:文件没有 filter 或读取失败
+ */
+int scdb_filter_check(struct scdb *c, char *key, unsigned int len)
+{
+    if (!c->fblocks)
+        return -1;
+    return filter_maybe(c, scdb_keyhash(c->flags, key, len));
+}
+
+/**
+ * @brief   从 c->kpos 开始沿 hash 表探测 c->khash, 需要先设置 khash/hpos/hslots/kpos
+ */
+static int probe(struct scdb *c, char *key, unsigned int len)
+{
+    char buf[8];
+    uint64_t pos;
+    uint64_t u;
+    uint32_t klen;
+    unsigned int slotsize = (c->fmt == SCDB_FMT_64) ? 16 : 8;
+
     while (c->loop < c->hslots)
     {
-        if (scdb_read(c, buf, 8, c->kpos) == -1)
+        if (slot_read(c, c->kpos, &u, &pos) == -1)
             return -1;
-        uint32_unpack(buf + 4, &pos);
         if (!pos)
             return 0;
         c->loop += 1;
-        c->kpos += 8;
-        if (c->kpos == c->hpos + (c->hslots << 3))
+        c->kpos += slotsize;
+        if (c->kpos == c->hpos + c->hslots * slotsize)
             c->kpos = c->hpos;
-        uint32_unpack(buf, &u);
         if (u == c->khash)
         {
             if (scdb_read(c, buf, 8, pos) == -1)
                 return -1;
-            uint32_unpack(buf, &u);
-            if (u == len)
+            uint32_unpack(buf, &klen);
+            if (klen == len)
                 switch (match(c, key, len, pos + 8))
                 {
                 case -1:
@@ -165,12 +513,518 @@ int scdb_findnext(struct scdb *c, char *key, unsigned int len)
     return 0;
 }
 
+int scdb_findnext(struct scdb *c, char *key, unsigned int len)
+{
+    uint64_t u;
+    unsigned int slotsize = (c->fmt == SCDB_FMT_64) ? 16 : 8;
+
+    if (!c->loop)
+    {
+        u = scdb_keyhash(c->flags, key, len);
+        if (c->fblocks)
+            switch (filter_maybe(c, u))
+            {
+            case -1:
+                return -1;
+            case 0:
+                return 0;
+            }
+        if (header_read(c, u, &c->hpos, &c->hslots) == -1)
+            return -1;
+        if (!c->hslots)
+            return 0;
+        c->khash = u;
+        c->kpos = c->hpos + ((u >> 8) % c->hslots) * slotsize;
+    }
+
+    return probe(c, key, len);
+}
+
 int scdb_find(struct scdb *c, char *key, unsigned int len)
 {
     scdb_findstart(c);
     return scdb_findnext(c, key, len);
 }
 
+/**
+ * @brief   打开 cdb 文件并常驻映射，供后续多次 scdb_lookup/scdb_findnext 使用
+ * @param c         指向 struct scdb 对象的指针
+ * @param cdb_fn    cdb 文件名
+ * @return 0:成功, -1:失败
+ * @note 使用完后调用 scdb_close() 释放; 无法 mmap (如超过地址空间) 时退回块缓存, 此时 c->map 为 0,
+ *       只能用 scdb_find/scdb_read, scdb_lookup/scdb_find_many/游标返回 -1
+ */
+int scdb_open(struct scdb *c, char *cdb_fn)
+{
+    return scdb_open_flags(c, cdb_fn, 0);
+}
+
+/**
+ * @brief   同 scdb_open, 可指定映射方式
+ * @param oflags    SCDB_O_* 组合, 见 scdb_init_flags(); 带 SCDB_O_NOMMAP/SCDB_O_DIRECT 或映射失败时不映射,
+ *                  只能用 scdb_find/scdb_read, scdb_lookup/scdb_find_many/游标返回 -1
+ */
+int scdb_open_flags(struct scdb *c, char *cdb_fn, int oflags)
+{
+    int mode = O_RDONLY | O_NDELAY;
+    int fd;
+
+#ifdef O_DIRECT
+    if (oflags & SCDB_O_DIRECT)
+        mode |= O_DIRECT;
+#endif
+    fd = open(cdb_fn, mode);
+    if (fd == -1)
+        return -1;
+
+    c->map = 0;
+    c->cache = 0;
+    c->zcache = 0;
+    scdb_init_flags(c, fd, oflags);
+    if (!c->map && !c->cache)
+    {
+        scdb_free(c);
+        close(fd);
+        c->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   在已打开的 cdb 中查找 key，返回指向映射区的值，不做拷贝
+ * @param c         scdb_open() 打开的对象
+ * @param key       去获取的 key
+ * @param keylen    key 的长度
+ * @param data      输出, 指向 mmap 内的值 (不以 '\0' 结尾)
+ * @param datalen   输出, 值的长度
+ * @return 1:找到, 0:未找到, -1:失败
+ * @note 不修改 c 的查找状态，多个线程可以共享同一个 c 并发调用;
+ *       返回的 data 在 scdb_close() 之前一直有效; SCDB_F_ZBLOCK 的文件返回 -1, 用 scdb_zget
+ */
+int scdb_lookup(struct scdb *c, char *key, unsigned int keylen, char **data, unsigned int *datalen)
+{
+    struct scdb t = *c;
+    int ret;
+
+    if (!t.map || (t.flags & SCDB_F_ZBLOCK))
+        return -1;
+
+    ret = scdb_find(&t, key, keylen);
+    if (ret == 1)
+    {
+        *data = t.map + t.dpos;
+        *datalen = t.dlen;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief   hash 对应的 header 在文件中的位置
+ */
+static uint64_t header_pos(struct scdb *c, uint64_t h)
+{
+    if (c->fmt == SCDB_FMT_64)
+        return SCDB64_PREAMBLE + ((h & 255) << 4);
+    return (h << 3) & 2047;
+}
+
+static void prefetch(struct scdb *c, uint64_t pos)
+{
+    if (pos < c->size)
+        __builtin_prefetch(c->map + pos);
+}
+
+/**
+ * @brief   批量查找多个 key
+ * @param c     scdb_open() 打开的对象
+ * @param q     查询数组, 调用前填好 key/keylen, 返回后 found 为 1/0/-1,
+ *              found 为 1 时 data/datalen 指向 mmap 内的值
+ * @param n     查询个数
+ * @return 找到的个数, -1:文件未映射或是 SCDB_F_ZBLOCK 格式
+ * @note 每 SCDB_FIND_BATCH 个 key 一组: 先算全部 hash 并预取 header,
+ *       再预取 hash 槽, 再预取记录, 最后从预取的槽开始比对 key; 各级访存相互重叠, 不再逐个等待缺页/缓存缺失.
+ *       带 filter 的文件同时预取 filter 块, 被 filter 排除的 key 不再预取后续各级.
+ *       与 scdb_lookup 一样不修改 c, 可多线程共享
+ */
+int scdb_find_many(struct scdb *c, struct scdb_query *q, unsigned int n)
+{
+    struct scdb t = *c;
+    unsigned int i, j, end;
+    unsigned int slotsize = (c->fmt == SCDB_FMT_64) ? 16 : 8;
+    uint64_t h, p;
+    int found = 0;
+
+    if (!c->map || (c->flags & SCDB_F_ZBLOCK))
+        return -1;
+
+    for (i = 0; i < n; i += SCDB_FIND_BATCH)
+    {
+        end = (n - i > SCDB_FIND_BATCH) ? i + SCDB_FIND_BATCH : n;
+
+        for (j = i; j < end; ++j)
+        {
+            q[j].h = scdb_keyhash(c->flags, q[j].key, q[j].keylen);
+            if (c->fblocks)
+                prefetch(c, filter_pos(c, q[j].h));
+            prefetch(c, header_pos(c, q[j].h));
+        }
+
+        for (j = i; j < end; ++j)
+        {
+            q[j].kpos = 0;
+            q[j].found = 0;
+            if (c->fblocks && (q[j].found = filter_maybe(c, q[j].h)) != 1)
+                continue;
+            q[j].found = 0;
+            if (header_read(c, q[j].h, &q[j].hpos, &q[j].hslots) == -1)
+            {
+                q[j].found = -1;
+                continue;
+            }
+            if (!q[j].hslots)
+                continue;
+            q[j].kpos = q[j].hpos + ((q[j].h >> 8) % q[j].hslots) * slotsize;
+            prefetch(c, q[j].kpos);
+        }
+
+        for (j = i; j < end; ++j)
+        {
+            if (!q[j].kpos)
+                continue;
+            if (slot_read(c, q[j].kpos, &h, &p) == -1 || !p)
+                continue;
+            if (h == q[j].h)
+                prefetch(c, p);
+        }
+
+        // 从预取过的槽开始探测, 不再重新计算 hash 和读取 filter/header
+        for (j = i; j < end; ++j)
+        {
+            if (q[j].kpos)
+            {
+                t.loop = 0;
+                t.khash = q[j].h;
+                t.hpos = q[j].hpos;
+                t.hslots = q[j].hslots;
+                t.kpos = q[j].kpos;
+                q[j].found = probe(&t, q[j].key, q[j].keylen);
+            }
+            if (q[j].found == 1)
+            {
+                q[j].data = t.map + t.dpos;
+                q[j].datalen = t.dlen;
+                ++found;
+            }
+            else
+            {
+                q[j].data = 0;
+                q[j].datalen = 0;
+            }
+        }
+    }
+
+    return found;
+}
+
+/**
+ * @brief   记录区的结束位置, 即第一张 hash 表的位置
+ */
+static int records_end(struct scdb *c, uint64_t *eod)
+{
+    uint64_t hslots;
+
+    return header_read(c, 0, eod, &hslots);
+}
+
+static uint64_t records_start(struct scdb *c)
+{
+    return (c->fmt == SCDB_FMT_64) ? SCDB64_HEADER : SCDB32_HEADER;
+}
+
+/**
+ * @brief   初始化游标, 按文件顺序遍历全部记录
+ * @param cur   游标
+ * @param c     scdb_open() 打开的对象
+ * @return 0:成功, -1:失败 (文件未映射或格式错误)
+ */
+int scdb_cursor_init(struct scdb_cursor *cur, struct scdb *c)
+{
+    uint64_t eod;
+
+    if (!c->map)
+        return -1;
+    if (records_end(c, &eod) == -1)
+        return -1;
+    if (eod < records_start(c) || eod > c->size)
+        return -1;
+
+    cur->c = c;
+    cur->pos = records_start(c);
+    cur->end = eod;
+    cur->eod = eod;
+
+    return 0;
+}
+
+/**
+ * @brief   取出下一条记录, key 与 data 直接指向映射区
+ * @return 1:取到, 0:遍历结束, -1:格式错误
+ */
+int scdb_cursor_next(struct scdb_cursor *cur, char **key, unsigned int *keylen, char **data, unsigned int *datalen)
+{
+    struct scdb *c = cur->c;
+    uint32_t klen, dlen;
+    uint64_t pos = cur->pos;
+
+    if (pos >= cur->end)
+        return 0;
+    if (cur->eod - pos < 8)
+        return -1;
+
+    uint32_unpack(c->map + pos, &klen);
+    uint32_unpack(c->map + pos + 4, &dlen);
+    if ((cur->eod - pos - 8 < klen) || (cur->eod - pos - 8 - klen < dlen))
+        return -1;
+
+    *key = c->map + pos + 8;
+    *keylen = klen;
+    *data = *key + klen;
+    *datalen = dlen;
+    cur->pos = pos + 8 + (uint64_t)klen + dlen;
+
+    return 1;
+}
+
+/**
+ * @brief   把记录区切成 n 段, 每段一个游标, 供 n 个线程并行遍历
+ * @param c     scdb_open() 打开的对象
+ * @param parts 输出, n 个游标, 合起来恰好覆盖全部记录, 部分段可能为空
+ * @param n     段数
+ * @return 0:成功, -1:失败
+ * @note 记录是变长的, 不能从任意偏移找到记录边界; 这里扫描一遍 hash 表 (每条记录 2 个槽),
+ *       对每个按字节均分的区间求出落在其中的最小记录位置, 作为该段的起点
+ */
+int scdb_cursor_split(struct scdb *c, struct scdb_cursor *parts, int n)
+{
+    struct scdb_cursor all;
+    unsigned int slotsize = (c->fmt == SCDB_FMT_64) ? 16 : 8;
+    uint64_t span, pos, h, p, tend, hpos, hslots;
+    uint64_t *first;
+    int i, k;
+
+    if (n <= 0 || scdb_cursor_init(&all, c) == -1)
+        return -1;
+
+    first = (uint64_t *)malloc((n + 1) * sizeof(uint64_t));
+    if (!first)
+        return -1;
+    for (k = 0; k <= n; ++k)
+        first[k] = all.eod;
+
+    span = all.eod - all.pos;
+
+    // hash 表按子表顺序紧跟在记录区之后
+    if (header_read(c, 255, &hpos, &hslots) == -1)
+        goto FAIL;
+    tend = hpos + hslots * slotsize;
+    if (tend > c->size)
+        goto FAIL;
+
+    if (span)
+    {
+        for (pos = all.eod; pos < tend; pos += slotsize)
+        {
+            if (slot_read(c, pos, &h, &p) == -1)
+                goto FAIL;
+            if (!p || p < all.pos || p >= all.eod)
+                continue;
+            k = (int)(((p - all.pos) * (unsigned __int128)n) / span);
+            if (p < first[k])
+                first[k] = p;
+        }
+    }
+
+    // 空区间的起点取后面第一个非空区间的起点
+    for (k = n - 1; k >= 0; --k)
+        if (first[k + 1] < first[k])
+            first[k] = first[k + 1];
+    first[0] = all.pos;
+
+    for (i = 0; i < n; ++i)
+    {
+        parts[i].c = c;
+        parts[i].pos = first[i];
+        parts[i].end = first[i + 1];
+        parts[i].eod = all.eod;
+    }
+
+    free(first);
+    return 0;
+
+FAIL:
+    free(first);
+    return -1;
+}
+
+/**
+ * @brief   关闭 scdb_open() 打开的 cdb
+ * @param c 指向 struct scdb 对象的指针
+ */
+void scdb_close(struct scdb *c)
+{
+    scdb_free(c);
+    if (c->fd != -1)
+    {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+/**
+ * @brief   取得偏移为 off 的块解压后的内容, 优先从解压块缓存中取
+ */
+static struct scdb_zslot *zblock_get(struct scdb *c, uint64_t off)
+{
+    struct scdb_zcache *zc = c->zcache;
+    struct scdb_zslot *s, *v;
+    char head[8], *src, *tmp = NULL;
+    uint32_t ulen, clen;
+    uLongf dlen;
+    int i, ret;
+
+    if (!zc)
+    {
+        zc = (struct scdb_zcache *)calloc(1, sizeof(struct scdb_zcache));
+        if (!zc)
+            return NULL;
+        c->zcache = zc;
+    }
+
+    v = zc->s;
+    for (i = 0; i < SCDB_ZCACHE_SLOTS; ++i)
+    {
+        s = zc->s + i;
+        if (s->off == off + 1)
+        {
+            ++zc->hits;
+            s->tick = ++zc->tick;
+            return s;
+        }
+        if (s->tick < v->tick)
+            v = s;
+    }
+    ++zc->misses;
+
+    if (scdb_read(c, head, 8, c->zpos + off) == -1)
+        return NULL;
+    uint32_unpack(head, &ulen);
+    uint32_unpack(head + 4, &clen);
+
+    if (c->map)
+    {
+        if ((c->zpos + off + 8 > c->size) || (c->size - c->zpos - off - 8 < clen))
+            return NULL;
+        src = c->map + c->zpos + off + 8;
+    }
+    else
+    {
+        tmp = (char *)malloc(clen ? clen : 1);
+        if (!tmp)
+            return NULL;
+        if (scdb_read(c, tmp, clen, c->zpos + off + 8) == -1)
+        {
+            free(tmp);
+            return NULL;
+        }
+        src = tmp;
+    }
+
+    v->off = 0;
+    if (ulen > v->cap || !v->buf)
+    {
+        free(v->buf);
+        v->buf = (char *)malloc(ulen ? ulen : 1);
+        v->cap = v->buf ? ulen : 0;
+        if (!v->buf)
+        {
+            free(tmp);
+            return NULL;
+        }
+    }
+
+    dlen = ulen;
+    ret = uncompress((Bytef *)v->buf, &dlen, (Bytef *)src, clen);
+    free(tmp);
+    if (ret != Z_OK || dlen != ulen)
+        return NULL;
+
+    v->off = off + 1;
+    v->len = ulen;
+    v->tick = ++zc->tick;
+    return v;
+}
+
+/**
+ * @brief   按记录中的值引用解压出值, 用于 scdb_find/游标取得的 SCDB_F_ZBLOCK 记录
+ * @param ref       记录中的值 (SCDB_ZREF 字节的引用)
+ * @param buf       输出, 值拷贝到这里
+ * @param size      buf 的大小
+ * @param datalen   输出, 值的长度; buf 不够大时也会填写
+ * @return 0:成功, -1:失败或 buf 不够大
+ * @note 会修改 c 的解压块缓存, 同一个 c 不能在多个线程中并发调用
+ */
+int scdb_zread(struct scdb *c, char *ref, unsigned int reflen, char *buf, unsigned int size, unsigned int *datalen)
+{
+    struct scdb_zslot *s;
+    uint64_t off;
+    uint32_t voff, vlen;
+
+    if (!(c->flags & SCDB_F_ZBLOCK) || reflen != SCDB_ZREF)
+        return -1;
+
+    uint64_unpack(ref, &off);
+    uint32_unpack(ref + 8, &voff);
+    uint32_unpack(ref + 12, &vlen);
+    *datalen = vlen;
+    if (vlen > size)
+        return -1;
+
+    s = zblock_get(c, off);
+    if (!s || voff > s->len || s->len - voff < vlen)
+        return -1;
+    memcpy(buf, s->buf + voff, vlen);
+
+    return 0;
+}
+
+/**
+ * @brief   在 SCDB_F_ZBLOCK 文件中查找 key, 值解压到 buf
+ * @param buf       输出, 值拷贝到这里
+ * @param size      buf 的大小
+ * @param datalen   输出, 值的长度; buf 不够大时返回 -1, datalen 为需要的大小
+ * @return 1:找到, 0:未找到, -1:失败
+ * @note 最近解压的 SCDB_ZCACHE_SLOTS 个块缓存在 c 中, 热点 key 不必重复解压;
+ *       同一个 c 不能在多个线程中并发调用
+ */
+int scdb_zget(struct scdb *c, char *key, unsigned int keylen, char *buf, unsigned int size, unsigned int *datalen)
+{
+    char ref[SCDB_ZREF];
+    int ret;
+
+    ret = scdb_find(c, key, keylen);
+    if (ret != 1)
+        return ret;
+    if (scdb_read(c, ref, sizeof(ref), c->dpos) == -1)
+        return -1;
+    if (scdb_zread(c, ref, c->dlen, buf, size, datalen) == -1)
+        return -1;
+
+    return 1;
+}
+
 /**
  * @brief   从 cdb 文件中获取指定 key 的值，没有返回 NULL
  * @param cdb_fn    指向 cdb 文件
@@ -186,16 +1040,35 @@ char *scdb_get_alloc(char *cdb_fn, char *key, unsigned int keylen)
         return NULL;
 
     struct scdb c;
+    c.map = 0;
+    c.cache = 0;
+    c.zcache = 0;
     scdb_init(&c, fd);
 
     int ret = scdb_find(&c, key, keylen);
     if (ret == 1)
     {
         unsigned int datalen = scdb_datalen(&c);
-        char *data = malloc(datalen);
+        char ref[SCDB_ZREF];
+        uint32_t u;
+
+        // 压缩文件中记录里是值的引用
+        if (c.flags & SCDB_F_ZBLOCK)
+        {
+            if (datalen != SCDB_ZREF || scdb_read(&c, ref, SCDB_ZREF, scdb_datapos(&c)) == -1)
+                goto CFAIL;
+            uint32_unpack(ref + 12, &u);
+            datalen = u;
+        }
+
+        char *data = malloc(datalen ? datalen : 1);
         if (!data)
             goto CFAIL;
-        if (scdb_read(&c, data, datalen, scdb_datapos(&c)) == -1)
+        if (c.flags & SCDB_F_ZBLOCK)
+            ret = scdb_zread(&c, ref, SCDB_ZREF, data, datalen, &datalen);
+        else
+            ret = scdb_read(&c, data, datalen, scdb_datapos(&c));
+        if (ret == -1)
         {
             free(data);
             goto CFAIL;
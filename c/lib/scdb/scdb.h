@@ -4,31 +4,161 @@
  * 
  * Exec:
  *  ./scdb ./cfg.cdb 'email'
+ *
+ * 常驻句柄用法 (只 mmap 一次，返回指向映射区的值，不拷贝):
+ *  struct scdb c;
+ *  char *data;
+ *  unsigned int dlen;
+ *  if (scdb_open(&c, "cfg.cdb") == 0) {
+ *      if (scdb_lookup(&c, "email", 5, &data, &dlen) == 1)
+ *          fwrite(data, 1, dlen, stdout);
+ *      scdb_close(&c);
+ *  }
+ *
+ * 不映射 (SCDB_O_NOMMAP/SCDB_O_DIRECT) 时用 scdb_find + scdb_read 取值, 一个句柄只能在一个线程中使用:
+ *  if (scdb_open_flags(&c, "cfg.cdb", SCDB_O_DIRECT) == 0) {
+ *      if (scdb_find(&c, "email", 5) == 1)
+ *          scdb_read(&c, buf, scdb_datalen(&c), scdb_datapos(&c));
+ *      scdb_close(&c);
+ *  }
+ *
+ * SCDB_F_ZBLOCK (值压缩) 的文件用 scdb_zget 把值解压到调用者的缓冲区:
+ *  if (scdb_zget(&c, "email", 5, buf, sizeof(buf), &dlen) == 1)
+ *      fwrite(buf, 1, dlen, stdout);
  */
 
 #ifndef S_CDB_H
 #define S_CDB_H
 
 #include <stdint.h>
+#include "utils.h"
 
 #define SCDB_HASHSTART 5381
 
+// 不映射时的块缓存: 按块号组相联, 组内 LRU 替换
+#define SCDB_CACHE_BLOCK 4096 // 块大小, 也是 O_DIRECT 的对齐单位
+#define SCDB_CACHE_SETS 64
+#define SCDB_CACHE_WAYS 4
+
+struct scdb_cblock
+{
+    uint64_t no;   // 块号 + 1, 0 表示空
+    uint64_t tick; // 最近一次访问
+    uint32_t len;  // 有效字节数, 文件末尾的块可能不满
+    char *buf;
+};
+
+struct scdb_cache
+{
+    struct scdb_cblock b[SCDB_CACHE_SETS * SCDB_CACHE_WAYS];
+    uint64_t tick;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t reads; // pread/preadv 次数
+    char *mem;
+};
+
+// SCDB_F_ZBLOCK 文件的解压块缓存, 按块偏移查找, LRU 替换
+#define SCDB_ZCACHE_SLOTS 8
+
+struct scdb_zslot
+{
+    uint64_t off;  // 块在压缩块段内的偏移 + 1, 0 表示空
+    uint64_t tick;
+    uint32_t len;  // 解压后的长度
+    uint32_t cap;
+    char *buf;
+};
+
+struct scdb_zcache
+{
+    struct scdb_zslot s[SCDB_ZCACHE_SLOTS];
+    uint64_t tick;
+    uint64_t hits;
+    uint64_t misses;
+};
+
 struct scdb
 {
     char *map; // 0 if no map is available
+    struct scdb_cache *cache; // 未映射时的块缓存, 0 表示直接 pread
+    struct scdb_zcache *zcache; // 解压块缓存, 第一次 scdb_zread 时分配
     int fd;
-    uint32_t size;   // initialized if map is nonzero
-    uint32_t loop;   // number of hash slots searched under this key
-    uint32_t khash;  // initialized if loop is nonzero
-    uint32_t kpos;   // initialized if loop is nonzero
-    uint32_t hpos;   // initialized if loop is nonzero
-    uint32_t hslots; // initialized if loop is nonzero
-    uint32_t dpos;   // initialized if scdb_findnext() returns 1
+    int fmt;         // SCDB_FMT_32 or SCDB_FMT_64
+    uint64_t flags;  // flags of SCDB_FMT_64 file
+    uint64_t fpos;    // filter 段位置, SCDB_F_FILTER
+    uint64_t fblocks; // filter 块数, 0 表示没有 filter
+    uint32_t fk;      // filter 每个 key 的 bit 数
+    uint64_t zpos;    // 压缩块段位置, SCDB_F_ZBLOCK
+    uint64_t size;   // 文件大小
+    uint64_t loop;   // number of hash slots searched under this key
+    uint64_t khash;  // initialized if loop is nonzero
+    uint64_t kpos;   // initialized if loop is nonzero
+    uint64_t hpos;   // initialized if loop is nonzero
+    uint64_t hslots; // initialized if loop is nonzero
+    uint64_t dpos;   // initialized if scdb_findnext() returns 1
     uint32_t dlen;   // initialized if scdb_findnext() returns 1
 };
 
+// scdb_open_flags/scdb_init_flags 的映射选项
+#define SCDB_O_POPULATE 0x1 // MAP_POPULATE, 打开时预读全部页面
+#define SCDB_O_WILLNEED 0x2 // madvise(MADV_WILLNEED)
+#define SCDB_O_RANDOM 0x4   // madvise(MADV_RANDOM)
+#define SCDB_O_NOMMAP 0x8   // 不映射, 用 pread + 块缓存读取
+#define SCDB_O_DIRECT 0x10  // 以 O_DIRECT 打开, 隐含 SCDB_O_NOMMAP
+
+// scdb_find_many 每组并发预取的 key 数
+#define SCDB_FIND_BATCH 32
+
+struct scdb_query
+{
+    char *key;            // 输入
+    unsigned int keylen;  // 输入
+    char *data;           // 输出, found 为 1 时指向 mmap 内的值
+    unsigned int datalen; // 输出
+    int found;            // 输出, 1:找到, 0:未找到, -1:失败
+    uint64_t h;           // 内部使用
+    uint64_t hpos;        // 内部使用
+    uint64_t hslots;      // 内部使用
+    uint64_t kpos;        // 内部使用
+};
+
+// 按文件顺序遍历记录, key/data 直接指向映射区
+struct scdb_cursor
+{
+    struct scdb *c;
+    uint64_t pos; // 下一条记录的位置
+    uint64_t end; // 本游标的结束位置 (不含)
+    uint64_t eod; // 记录区的结束位置
+};
+
 #define scdb_datalen(c) ((c)->dlen)
 #define scdb_datapos(c) ((c)->dpos)
+// 指向 mmap 中当前命中记录的值，只在 scdb_find/scdb_findnext 返回 1 且文件已映射时有效
+#define scdb_dataptr(c) ((c)->map ? (c)->map + (c)->dpos : (char *)0)
+
+void scdb_init(struct scdb *c, int fd);
+void scdb_init_flags(struct scdb *c, int fd, int oflags);
+void scdb_free(struct scdb *c);
+int scdb_read(struct scdb *c, char *buf, unsigned int len, uint64_t pos);
+
+void scdb_findstart(struct scdb *c);
+int scdb_findnext(struct scdb *c, char *key, unsigned int len);
+int scdb_find(struct scdb *c, char *key, unsigned int len);
+int scdb_filter_check(struct scdb *c, char *key, unsigned int len);
+
+int scdb_open(struct scdb *c, char *cdb_fn);
+int scdb_open_flags(struct scdb *c, char *cdb_fn, int oflags);
+int scdb_lookup(struct scdb *c, char *key, unsigned int keylen, char **data, unsigned int *datalen);
+int scdb_find_many(struct scdb *c, struct scdb_query *q, unsigned int n);
+void scdb_close(struct scdb *c);
+
+int scdb_cursor_init(struct scdb_cursor *cur, struct scdb *c);
+int scdb_cursor_next(struct scdb_cursor *cur, char **key, unsigned int *keylen, char **data, unsigned int *datalen);
+int scdb_cursor_split(struct scdb *c, struct scdb_cursor *parts, int n);
+
+int scdb_zread(struct scdb *c, char *ref, unsigned int reflen, char *buf, unsigned int size, unsigned int *datalen);
+int scdb_zget(struct scdb *c, char *key, unsigned int keylen, char *buf, unsigned int size, unsigned int *datalen);
 
 char *scdb_get_alloc(char *cdb_fn, char *key, unsigned int keylen);
 
@@ -0,0 +1,429 @@
+/**
+ * scdb 查找性能对比
+ *
+ * Build:
+ *  make scdb_bench
+ *
+ * Exec:
+ *  ./scdb_bench [记录数] [查找次数]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "scdb.h"
+#include "scdb_make.h"
+
+#define BENCH_CDB "scdb_bench.cdb"
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// 丢掉文件的 page cache, 模拟冷启动
+static void drop_cache(char *fn)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// 逐个 scdb_lookup 与 scdb_find_many 的每 key 周期数
+static void bench_many(char *fn, struct scdb_query *q, int n, int cold, int oflags)
+{
+    struct scdb c;
+    char *data;
+    unsigned int dlen;
+    uint64_t t0, t1;
+    int i, found;
+
+    if (cold)
+        drop_cache(fn);
+    if (scdb_open_flags(&c, fn, oflags) == -1)
+        return;
+    found = 0;
+    t0 = now_cycles();
+    for (i = 0; i < n; i++)
+        if (scdb_lookup(&c, q[i].key, q[i].keylen, &data, &dlen) == 1)
+            found++;
+    t1 = now_cycles();
+    scdb_close(&c);
+    printf("  %-5s serial     : %d found, %.0f cycles/key\n", cold ? "cold" : "warm", found, (double)(t1 - t0) / n);
+
+    if (cold)
+        drop_cache(fn);
+    if (scdb_open_flags(&c, fn, oflags) == -1)
+        return;
+    t0 = now_cycles();
+    found = scdb_find_many(&c, q, n);
+    t1 = now_cycles();
+    scdb_close(&c);
+    printf("  %-5s find_many  : %d found, %.0f cycles/key\n", cold ? "cold" : "warm", found, (double)(t1 - t0) / n);
+}
+
+static int gen_cdb(char *fn, int num, uint64_t flags)
+{
+    struct scdb_make c;
+    char key[64], val[128];
+    int i, klen, vlen;
+
+    int fd = open(fn, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+    if (fd == -1)
+        return -1;
+    if (scdb_make_start_flags(&c, fd, flags) == -1)
+        goto FAIL;
+
+    for (i = 0; i < num; i++)
+    {
+        klen = snprintf(key, sizeof(key), "user%d@example.com", i);
+        vlen = snprintf(val, sizeof(val), "route=smtp:[10.0.%d.%d]:25", (i >> 8) & 255, i & 255);
+        if (scdb_make_add(&c, key, klen, val, vlen) == -1)
+            goto FAIL;
+    }
+
+    if (scdb_make_finish(&c) == -1)
+        goto FAIL;
+
+    close(fd);
+    return 0;
+
+FAIL:
+    close(fd);
+    return -1;
+}
+
+// 不映射时的查找: 取值拷贝到 buf
+static void bench_nommap(char *fn, int num, int loops)
+{
+    static const char *names[] = {"mmap", "pread, no cache", "block cache", "O_DIRECT + cache"};
+    static const int modes[] = {0, SCDB_O_NOMMAP, SCDB_O_NOMMAP, SCDB_O_DIRECT};
+    struct scdb c, t;
+    char key[64], buf[256];
+    double t0, t1;
+    int i, m, klen, found;
+
+    for (m = 0; m < 4; m++)
+    {
+        if (scdb_open_flags(&c, fn, modes[m]) == -1)
+        {
+            printf("  %-17s: open fail\n", names[m]);
+            continue;
+        }
+        // 去掉缓存, 每次读都是一次 pread
+        t = c;
+        if (m == 1)
+            t.cache = 0;
+
+        found = 0;
+        t0 = now_sec();
+        for (i = 0; i < loops; i++)
+        {
+            klen = snprintf(key, sizeof(key), "user%d@example.com", (int)((i * 7919LL) % num));
+            if (scdb_find(&t, key, klen) == 1 && scdb_datalen(&t) <= sizeof(buf) &&
+                scdb_read(&t, buf, scdb_datalen(&t), scdb_datapos(&t)) == 0)
+                found++;
+        }
+        t1 = now_sec();
+
+        printf("  %-17s: %d found, %.1f ns/lookup", names[m], found, (t1 - t0) * 1e9 / loops);
+        if (t.cache)
+            printf(", %.2f reads/lookup, hit %.1f%%", (double)t.cache->reads / loops,
+                   t.cache->hits * 100.0 / (t.cache->hits + t.cache->misses));
+        printf("\n");
+        scdb_close(&c);
+    }
+}
+
+// 长 key (邮件地址) 的查找: djb hash 与 SCDB_F_HASH64
+static void bench_hash(int num, int loops)
+{
+    static const uint64_t flags[] = {SCDB_F_64, SCDB_F_64 | SCDB_F_HASH64};
+    struct scdb_make m;
+    struct scdb c;
+    char *keys, *data;
+    unsigned int *klens, dlen;
+    uint64_t t0, t1, t2;
+    volatile uint64_t sum; // 防止 hash 计算被优化掉
+    int i, j, r, fd, found;
+
+    keys = malloc((size_t)num * 64);
+    klens = malloc(num * sizeof(unsigned int));
+    if (!keys || !klens)
+        goto END;
+    for (i = 0; i < num; i++)
+        klens[i] = snprintf(keys + (size_t)i * 64, 64, "firstname.lastname.%d@mail.example-company.com", i);
+
+    for (r = 0; r < 2; r++)
+    {
+        fd = open(BENCH_CDB, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+        if (fd == -1)
+            goto END;
+        if (scdb_make_start_flags(&m, fd, flags[r]) == -1)
+        {
+            close(fd);
+            goto END;
+        }
+        for (i = 0; i < num; i++)
+            scdb_make_add(&m, keys + (size_t)i * 64, klens[i], "1", 1);
+        j = scdb_make_finish(&m);
+        close(fd);
+        if (j == -1 || scdb_open(&c, BENCH_CDB) == -1)
+            goto END;
+
+        sum = 0;
+        t0 = now_cycles();
+        for (i = 0; i < loops; i++)
+        {
+            j = (int)((i * 7919LL) % num);
+            sum += scdb_keyhash(flags[r], keys + (size_t)j * 64, klens[j]);
+        }
+        t1 = now_cycles();
+        found = 0;
+        for (i = 0; i < loops; i++)
+        {
+            j = (int)((i * 7919LL) % num);
+            if (scdb_lookup(&c, keys + (size_t)j * 64, klens[j], &data, &dlen) == 1)
+                found++;
+        }
+        t2 = now_cycles();
+
+        printf("  %-12s: hash %.0f cycles/key, lookup %.0f cycles/key, %d found\n",
+               r ? "hash64" : "djb", (double)(t1 - t0) / loops, (double)(t2 - t1) / loops, found);
+        scdb_close(&c);
+    }
+
+END:
+    free(keys);
+    free(klens);
+}
+
+static int policy_value(char *buf, int size, int i)
+{
+    return snprintf(buf, size,
+                    "{\"user\":\"user%d@example.com\",\"policy\":{\"quota\":%d,\"allow\":[\"smtp\",\"imap\",\"pop3\"],"
+                    "\"route\":\"smtp:[10.0.%d.%d]:25\",\"spam\":{\"action\":\"tag\",\"score\":%d}}}",
+                    i, (i % 50) * 1024, (i >> 8) & 255, i & 255, 5 + i % 3);
+}
+
+// 值压缩: 文件大小, 随机查找与热点 key 查找的延迟
+static void bench_zblock(int num, int loops)
+{
+    static const unsigned int sizes[] = {0, 1024, 4096, 16384};
+    struct scdb_make m;
+    struct scdb c;
+    char key[64], val[512], *data;
+    unsigned int dlen;
+    struct stat st;
+    double t0, t1, t2;
+    int i, r, j, klen, vlen, fd;
+
+    for (r = 0; r < 4; r++)
+    {
+        fd = open(BENCH_CDB, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+        if (fd == -1)
+            return;
+        if (scdb_make_start_flags(&m, fd, r ? SCDB_F_64 | SCDB_F_ZBLOCK : SCDB_F_64) == -1 ||
+            (r && scdb_make_set_zblock(&m, sizes[r], -1) == -1))
+        {
+            close(fd);
+            return;
+        }
+        for (i = 0; i < num; i++)
+        {
+            klen = snprintf(key, sizeof(key), "user%d@example.com", i);
+            vlen = policy_value(val, sizeof(val), i);
+            scdb_make_add(&m, key, klen, val, vlen);
+        }
+        j = scdb_make_finish(&m);
+        close(fd);
+        if (j == -1 || stat(BENCH_CDB, &st) == -1 || scdb_open(&c, BENCH_CDB) == -1)
+            return;
+
+        t0 = now_sec();
+        for (i = 0; i < loops; i++)
+        {
+            klen = snprintf(key, sizeof(key), "user%d@example.com", (int)((i * 7919LL) % num));
+            if (r)
+                scdb_zget(&c, key, klen, val, sizeof(val), &dlen);
+            else if (scdb_lookup(&c, key, klen, &data, &dlen) == 1)
+                memcpy(val, data, dlen);
+        }
+        t1 = now_sec();
+        // 热点: 反复查找同一块中的少量 key
+        for (i = 0; i < loops; i++)
+        {
+            klen = snprintf(key, sizeof(key), "user%d@example.com", i & 15);
+            if (r)
+                scdb_zget(&c, key, klen, val, sizeof(val), &dlen);
+            else if (scdb_lookup(&c, key, klen, &data, &dlen) == 1)
+                memcpy(val, data, dlen);
+        }
+        t2 = now_sec();
+
+        if (r)
+            printf("  zlib %2uKB block: ", sizes[r] >> 10);
+        else
+            printf("  uncompressed  : ");
+        printf("%8.1f MB, random %6.1f ns/lookup, hot %5.1f ns/lookup\n",
+               st.st_size / 1048576.0, (t1 - t0) * 1e9 / loops, (t2 - t1) * 1e9 / loops);
+        scdb_close(&c);
+    }
+}
+
+// 未命中查找的延迟, 以及 filter 的误判率
+static void bench_filter(int num, int loops)
+{
+    struct scdb c;
+    char key[64];
+    char *data;
+    unsigned int dlen;
+    uint64_t t0, t1;
+    int i, klen, fp, round;
+
+    for (round = 0; round < 2; round++)
+    {
+        if (gen_cdb(BENCH_CDB, num, round ? SCDB_F_64 | SCDB_F_FILTER : SCDB_F_64) == -1)
+            return;
+        if (scdb_open(&c, BENCH_CDB) == -1)
+            return;
+
+        fp = 0;
+        t0 = now_cycles();
+        for (i = 0; i < loops; i++)
+        {
+            klen = snprintf(key, sizeof(key), "nobody%d@example.org", i);
+            if (scdb_lookup(&c, key, klen, &data, &dlen) != 0)
+                fp = -1;
+        }
+        t1 = now_cycles();
+
+        if (round)
+            for (i = 0; i < loops; i++)
+            {
+                klen = snprintf(key, sizeof(key), "nobody%d@example.org", i);
+                if (scdb_filter_check(&c, key, klen) == 1)
+                    fp++;
+            }
+
+        printf("  %-14s: %.0f cycles/miss", round ? "with filter" : "without filter", (double)(t1 - t0) / loops);
+        if (round)
+            printf(", false positive %.3f%% (%d bits/key)", fp * 100.0 / loops, SCDB_FILTER_BITS);
+        printf("\n");
+        scdb_close(&c);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num = argc > 1 ? atoi(argv[1]) : 100000;
+    int loops = argc > 2 ? atoi(argv[2]) : 200000;
+    char key[64];
+    char *data;
+    unsigned int dlen;
+    int i, klen, found;
+    double t0, t1;
+    struct scdb c;
+
+    if (gen_cdb(BENCH_CDB, num, 0) == -1)
+    {
+        fprintf(stderr, "generate %s fail\n", BENCH_CDB);
+        return 1;
+    }
+
+    // 每次查找都 open + mmap + munmap + close
+    found = 0;
+    t0 = now_sec();
+    for (i = 0; i < loops; i++)
+    {
+        klen = snprintf(key, sizeof(key), "user%d@example.com", (int)((i * 7919LL) % num));
+        data = scdb_get_alloc(BENCH_CDB, key, klen);
+        if (data)
+        {
+            found++;
+            free(data);
+        }
+    }
+    t1 = now_sec();
+    printf("scdb_get_alloc: %d lookups, %d found, %.1f ns/lookup\n",
+           loops, found, (t1 - t0) * 1e9 / loops);
+
+    // 常驻映射, 零拷贝
+    if (scdb_open(&c, BENCH_CDB) == -1)
+    {
+        fprintf(stderr, "open %s fail\n", BENCH_CDB);
+        return 1;
+    }
+    found = 0;
+    t0 = now_sec();
+    for (i = 0; i < loops; i++)
+    {
+        klen = snprintf(key, sizeof(key), "user%d@example.com", (int)((i * 7919LL) % num));
+        if (scdb_lookup(&c, key, klen, &data, &dlen) == 1)
+            found++;
+    }
+    t1 = now_sec();
+    printf("scdb_lookup:    %d lookups, %d found, %.1f ns/lookup\n",
+           loops, found, (t1 - t0) * 1e9 / loops);
+    scdb_close(&c);
+
+    // 批量查找: 一半命中一半未命中, 随机分布
+    struct scdb_query *q = calloc(loops, sizeof(struct scdb_query));
+    char *keys = malloc(loops * 64);
+    if (!q || !keys)
+        return 1;
+    srand(1);
+    for (i = 0; i < loops; i++)
+    {
+        q[i].key = keys + i * 64;
+        if (i & 1)
+            q[i].keylen = snprintf(q[i].key, 64, "user%d@example.com", rand() % num);
+        else
+            q[i].keylen = snprintf(q[i].key, 64, "nobody%d@example.org", rand());
+    }
+    printf("scdb_find_many (batch %d):\n", SCDB_FIND_BATCH);
+    bench_many(BENCH_CDB, q, loops, 1, 0);
+    bench_many(BENCH_CDB, q, loops, 0, SCDB_O_POPULATE);
+    printf("scdb_find_many with SCDB_O_POPULATE|SCDB_O_RANDOM:\n");
+    bench_many(BENCH_CDB, q, loops, 1, SCDB_O_POPULATE | SCDB_O_RANDOM);
+    free(q);
+    free(keys);
+
+    printf("without mmap (scdb_find + scdb_read):\n");
+    bench_nommap(BENCH_CDB, num, loops);
+
+    printf("long keys (64-bit format):\n");
+    bench_hash(num, loops);
+
+    printf("compressed values (SCDB_F_ZBLOCK, JSON policies):\n");
+    bench_zblock(num, loops);
+
+    printf("miss latency (64-bit format):\n");
+    bench_filter(num, loops);
+
+    unlink(BENCH_CDB);
+    return 0;
+}
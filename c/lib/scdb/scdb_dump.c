@@ -0,0 +1,127 @@
+/**
+ * 按文件顺序输出 cdb 的全部记录, 输出格式可直接作为 scdb_make_gen_file 的输入
+ *
+ * key<sep>value 格式无法表示 key 含 sep 或换行, 以及 value 含换行的记录,
+ * 遇到这样的记录时报错退出; -c 输出 cdbmake 格式 (+klen,dlen:key->data), 可表示任意字节
+ *
+ * Build:
+ *  make scdb_dump
+ *
+ * Exec:
+ *  ./scdb_dump cfg.cdb '=' > cfg.ini
+ *  ./scdb_make 'cfg.ini' '=' 'cfg2.cdb'
+ *
+ *  ./scdb_dump -c cfg.cdb > cfg.cdbmake    // scdb_make_gen_file(fn, SCDB_CDBMAKE, ...)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scdb.h"
+
+void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c] [cdb file] [sep]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct scdb c;
+    struct scdb_cursor cur;
+    char *key, *data, *zbuf = NULL, *p;
+    unsigned int klen, dlen, vlen, zsize = 0;
+    char *fn, sep;
+    int cdbmake = 0;
+    int ret;
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0)
+    {
+        cdbmake = 1;
+        ++argv;
+        --argc;
+    }
+    if (argc < 2)
+        usage(argv[0]);
+    fn = argv[1];
+    sep = argc > 2 ? argv[2][0] : '=';
+
+    if (scdb_open(&c, fn) == -1)
+    {
+        fprintf(stderr, "open %s fail\n", fn);
+        return 1;
+    }
+    if (!c.map)
+    {
+        fprintf(stderr, "%s: cannot mmap\n", fn);
+        scdb_close(&c);
+        return 1;
+    }
+    if (scdb_cursor_init(&cur, &c) == -1)
+    {
+        fprintf(stderr, "%s: bad format\n", fn);
+        scdb_close(&c);
+        return 1;
+    }
+
+    while ((ret = scdb_cursor_next(&cur, &key, &klen, &data, &dlen)) == 1)
+    {
+        // 压缩文件的记录中是值的引用, 解压后输出
+        if (c.flags & SCDB_F_ZBLOCK)
+        {
+            if (scdb_zread(&c, data, dlen, zbuf, zsize, &vlen) == -1)
+            {
+                // 缓冲区不够大时扩大后重试
+                if (vlen <= zsize || !(p = realloc(zbuf, vlen)))
+                {
+                    ret = -1;
+                    break;
+                }
+                zbuf = p;
+                zsize = vlen;
+                if (scdb_zread(&c, data, dlen, zbuf, zsize, &vlen) == -1)
+                {
+                    ret = -1;
+                    break;
+                }
+            }
+            data = zbuf;
+            dlen = vlen;
+        }
+
+        if (cdbmake)
+        {
+            printf("+%u,%u:", klen, dlen);
+            fwrite(key, 1, klen, stdout);
+            fputs("->", stdout);
+            fwrite(data, 1, dlen, stdout);
+            putchar('\n');
+            continue;
+        }
+
+        // 读回时按第一个 sep 切分, 按换行分行
+        if (memchr(key, sep, klen) || memchr(key, '\n', klen) || memchr(data, '\n', dlen))
+        {
+            fprintf(stderr, "%s: record at %llu cannot be written as key%cvalue, use -c\n",
+                    fn, (unsigned long long)(key - c.map - 8), sep);
+            ret = -1;
+            break;
+        }
+        fwrite(key, 1, klen, stdout);
+        putchar(sep);
+        fwrite(data, 1, dlen, stdout);
+        putchar('\n');
+    }
+    if (ret == 0 && cdbmake)
+        putchar('\n');
+
+    scdb_close(&c);
+    free(zbuf);
+
+    if (ret == -1 || fflush(stdout) == EOF)
+    {
+        fprintf(stderr, "%s: dump fail\n", fn);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include "scdb_layer.h"
+
+/**
+ * @brief   向 delta 写入一条 key -> value
+ * @param c         scdb_make_start*() 开始的对象
+ * @return 0:成功, -1:失败
+ */
+int scdb_layer_put(struct scdb_make *c, char *key, unsigned int keylen, char *data, unsigned int datalen)
+{
+    char tag = SCDB_LAYER_SET;
+
+    if (datalen == 0xffffffff)
+        return -1;
+    if (scdb_make_addbegin(c, keylen, datalen + 1) == -1)
+        return -1;
+    if (buffer_putalign(&c->b, key, keylen) == -1)
+        return -1;
+    if (buffer_putalign(&c->b, &tag, 1) == -1)
+        return -1;
+    if (buffer_putalign(&c->b, data, datalen) == -1)
+        return -1;
+    return scdb_make_addend(c, keylen, datalen + 1, scdb_keyhash(c->flags, key, keylen));
+}
+
+/**
+ * @brief   向 delta 写入删除标记, 屏蔽更旧层中的 key
+ * @return 0:成功, -1:失败
+ */
+int scdb_layer_del(struct scdb_make *c, char *key, unsigned int keylen)
+{
+    char tag = SCDB_LAYER_DEL;
+
+    return scdb_make_add(c, key, keylen, &tag, 1);
+}
+
+/**
+ * @brief   打开 base 与 delta 文件
+ * @param l         指向 struct scdb_layers 对象的指针
+ * @param base_fn   base cdb 文件
+ * @param delta_fns delta 文件列表, 从旧到新
+ * @param ndelta    delta 个数, 最多 SCDB_LAYER_MAX - 1
+ * @return 0:成功, -1:失败
+ */
+int scdb_layers_open(struct scdb_layers *l, char *base_fn, char **delta_fns, int ndelta)
+{
+    int i;
+
+    l->n = 0;
+    if (ndelta < 0 || ndelta >= SCDB_LAYER_MAX)
+        return -1;
+
+    if (scdb_open(&l->db[0], base_fn) == -1)
+        return -1;
+    l->n = 1;
+
+    for (i = 0; i < ndelta; ++i)
+    {
+        if (scdb_open(&l->db[l->n], delta_fns[i]) == -1)
+        {
+            scdb_layers_close(l);
+            return -1;
+        }
+        ++l->n;
+    }
+
+    // 查找与合并都直接使用映射区中的值
+    for (i = 0; i < l->n; ++i)
+        if (!l->db[i].map || (l->db[i].flags & SCDB_F_ZBLOCK))
+        {
+            scdb_layers_close(l);
+            return -1;
+        }
+
+    return 0;
+}
+
+/**
+ * @brief   从最新的层开始查找 key
+ * @param data      输出, 指向映射区的值
+ * @param datalen   输出, 值的长度
+ * @return 1:找到, 0:未找到或已删除, -1:失败
+ * @note 与 scdb_lookup 一样不修改 l, 可多线程共享
+ */
+int scdb_layers_lookup(struct scdb_layers *l, char *key, unsigned int keylen, char **data, unsigned int *datalen)
+{
+    char *d;
+    unsigned int dlen;
+    int i, ret;
+
+    for (i = l->n - 1; i > 0; --i)
+    {
+        ret = scdb_lookup(&l->db[i], key, keylen, &d, &dlen);
+        if (ret == -1)
+            return -1;
+        if (ret == 0)
+            continue;
+
+        if (dlen == 0 || d[0] != SCDB_LAYER_SET)
+            return 0;
+        *data = d + 1;
+        *datalen = dlen - 1;
+        return 1;
+    }
+
+    if (l->n == 0)
+        return -1;
+    return scdb_lookup(&l->db[0], key, keylen, data, datalen);
+}
+
+/**
+ * @brief   key 是否出现在比 layer 更新的层中 (包括删除标记)
+ */
+static int shadowed(struct scdb_layers *l, int layer, char *key, unsigned int keylen)
+{
+    char *d;
+    unsigned int dlen;
+    int i, ret;
+
+    for (i = l->n - 1; i > layer; --i)
+    {
+        ret = scdb_lookup(&l->db[i], key, keylen, &d, &dlen);
+        if (ret != 0)
+            return ret;
+    }
+    return 0;
+}
+
+/**
+ * @brief   把一层中未被更新层覆盖的记录写入 m
+ */
+static int compact_layer(struct scdb_layers *l, int layer, struct scdb_make *m)
+{
+    struct scdb_cursor cur;
+    char *key, *data;
+    unsigned int klen, dlen;
+    int ret;
+
+    if (scdb_cursor_init(&cur, &l->db[layer]) == -1)
+        return -1;
+
+    while ((ret = scdb_cursor_next(&cur, &key, &klen, &data, &dlen)) == 1)
+    {
+        switch (shadowed(l, layer, key, klen))
+        {
+        case -1:
+            return -1;
+        case 1:
+            continue;
+        }
+
+        if (layer > 0)
+        {
+            if (dlen == 0 || data[0] != SCDB_LAYER_SET)
+                continue;
+            ++data;
+            --dlen;
+        }
+        if (scdb_make_add(m, key, klen, data, dlen) == -1)
+            return -1;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief   把所有层合并成一个新的 base 文件, 删除标记和被覆盖的值不再保留
+ * @param l         已打开的层
+ * @param cdb_fn    新 base 文件名, 可以与当前 base 相同 (先写 .tmp 再 rename)
+ * @param flags     新文件的 SCDB_F_* 标志, 不能含 SCDB_F_ZBLOCK
+ * @return 写入的记录数, -1:失败
+ * @note 只读取 l, 可以在后台线程中与查找并发执行; 完成后调用者用新 base 和
+ *       合并开始之后产生的 delta 重新 scdb_layers_open
+ */
+int scdb_layers_compact(struct scdb_layers *l, char *cdb_fn, uint64_t flags)
+{
+    struct scdb_make m;
+    char tmp_fn[1024];
+    int fd, i;
+
+    if (flags & SCDB_F_ZBLOCK)
+        return -1;
+
+    snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", cdb_fn);
+    fd = open(tmp_fn, O_WRONLY | O_NDELAY | O_TRUNC | O_CREAT, 0644);
+    if (fd == -1)
+        return -1;
+    if (scdb_make_start_flags(&m, fd, flags) == -1)
+        goto FAIL;
+
+    for (i = 0; i < l->n; ++i)
+        if (compact_layer(l, i, &m) == -1)
+            goto FAIL;
+
+    if (scdb_make_finish(&m) == -1)
+        goto FAIL;
+    if (fsync(fd) == -1)
+        goto FAIL;
+    if (rename(tmp_fn, cdb_fn))
+        goto FAIL;
+
+    close(fd);
+    return (int)m.numentries;
+
+FAIL:
+    close(fd);
+    unlink(tmp_fn);
+    return -1;
+}
+
+/**
+ * @brief   关闭所有层
+ */
+void scdb_layers_close(struct scdb_layers *l)
+{
+    int i;
+
+    for (i = 0; i < l->n; ++i)
+        scdb_close(&l->db[i]);
+    l->n = 0;
+}
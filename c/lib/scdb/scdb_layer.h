@@ -0,0 +1,53 @@
+/**
+ * 分层 scdb: 一个 base 文件加若干小的 delta 文件, 修改少量 key 时不必重建整个 cdb
+ *
+ * delta 文件由 scdb_layer_put/scdb_layer_del 写入, 值的第一个字节是标记:
+ *  '+' 后面是值, '-' 表示删除 (tombstone). base 文件是普通 cdb.
+ * 查找从最新的 delta 开始, 第一个包含该 key 的层决定结果.
+ * 层数多了以后用 scdb_layers_compact 合并成新的 base, 它只读各层的映射, 可以放在后台线程执行.
+ * 各层都不能是 SCDB_F_ZBLOCK (值压缩) 格式.
+ *
+ * Usage:
+ *  // 写 delta
+ *  scdb_make_start(&m, fd);
+ *  scdb_layer_put(&m, "a", 1, "1", 1);
+ *  scdb_layer_del(&m, "b", 1);
+ *  scdb_make_finish(&m);
+ *
+ *  // 查找
+ *  char *deltas[] = {"route.d1.cdb", "route.d2.cdb"}; // 旧 -> 新
+ *  scdb_layers_open(&l, "route.cdb", deltas, 2);
+ *  scdb_layers_lookup(&l, key, keylen, &data, &dlen);
+ *
+ *  // 合并
+ *  scdb_layers_compact(&l, "route.cdb", 0);
+ *  scdb_layers_close(&l);
+ */
+
+#ifndef S_CDB_LAYER_H
+#define S_CDB_LAYER_H
+
+#include <stdint.h>
+#include "scdb.h"
+#include "scdb_make.h"
+
+#define SCDB_LAYER_MAX 64
+
+#define SCDB_LAYER_SET '+'
+#define SCDB_LAYER_DEL '-'
+
+struct scdb_layers
+{
+    struct scdb db[SCDB_LAYER_MAX]; // db[0] 为 base, db[n - 1] 为最新的 delta
+    int n;
+};
+
+int scdb_layer_put(struct scdb_make *c, char *key, unsigned int keylen, char *data, unsigned int datalen);
+int scdb_layer_del(struct scdb_make *c, char *key, unsigned int keylen);
+
+int scdb_layers_open(struct scdb_layers *l, char *base_fn, char **delta_fns, int ndelta);
+int scdb_layers_lookup(struct scdb_layers *l, char *key, unsigned int keylen, char **data, unsigned int *datalen);
+int scdb_layers_compact(struct scdb_layers *l, char *cdb_fn, uint64_t flags);
+void scdb_layers_close(struct scdb_layers *l);
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * scdb_make_gen_file 导入性能对比: 原来的 fgets 逐行读取与 scdb_make_load
+ *
+ * Build:
+ *  make scdb_load_bench
+ *
+ * Exec:
+ *  ./scdb_load_bench [记录数]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "scdb_make.h"
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 原来的实现: fgets 读入 4096 字节的缓冲区, 值中保留换行符
+static int gen_file_fgets(char *fn, char sep, char *cdb_fn)
+{
+    struct scdb_make c;
+    char buf[4096] = {0};
+    char *tok;
+    int fd, num = 0;
+    FILE *fp;
+
+    fp = fopen(fn, "r");
+    if (!fp)
+        return -1;
+    fd = open(cdb_fn, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+    if (fd == -1)
+        goto FAIL;
+    if (scdb_make_start(&c, fd) == -1)
+        goto FAIL;
+
+    while (fgets(buf, sizeof(buf), fp) != NULL)
+    {
+        tok = (char *)memchr(buf, sep, strlen(buf));
+        if (!tok)
+            continue;
+        *tok = '\0';
+        if (scdb_make_add(&c, buf, strlen(buf), tok + 1, strlen(tok + 1)) == -1)
+            goto FAIL;
+        num++;
+    }
+
+    if (scdb_make_finish(&c) == -1)
+        goto FAIL;
+    if (fsync(fd) == -1)
+        goto FAIL;
+
+    fclose(fp);
+    close(fd);
+    return num;
+
+FAIL:
+    fclose(fp);
+    if (fd != -1)
+        close(fd);
+    return -1;
+}
+
+static int gen_input(char *fn, char *cdbmake_fn, int num)
+{
+    char key[64], val[128];
+    int i, klen, vlen;
+    FILE *fp, *fc;
+
+    fp = fopen(fn, "w");
+    fc = fopen(cdbmake_fn, "w");
+    if (!fp || !fc)
+        return -1;
+
+    for (i = 0; i < num; i++)
+    {
+        klen = snprintf(key, sizeof(key), "user%d@example.com", i);
+        vlen = snprintf(val, sizeof(val), "route=smtp:[10.0.%d.%d]:25", (i >> 8) & 255, i & 255);
+        fprintf(fp, "%s=%s\n", key, val);
+        fprintf(fc, "+%d,%d:%s->%s\n", klen, vlen, key, val);
+    }
+    fprintf(fc, "\n");
+
+    fclose(fp);
+    fclose(fc);
+    return 0;
+}
+
+static int same_file(char *a, char *b)
+{
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "cmp -s %s %s", a, b);
+    return system(cmd) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int num = argc > 1 ? atoi(argv[1]) : 2000000;
+    double t0, t1, t2, t3;
+    int n1, n2, n3;
+
+    if (gen_input("scdb_load_bench.txt", "scdb_load_bench.cdbmake", num) == -1)
+    {
+        fprintf(stderr, "gen input fail\n");
+        return 1;
+    }
+
+    t0 = now_sec();
+    n1 = gen_file_fgets("scdb_load_bench.txt", '=', "scdb_load_bench.0.cdb");
+    t1 = now_sec();
+    n2 = scdb_make_gen_file("scdb_load_bench.txt", '=', "scdb_load_bench.1.cdb");
+    t2 = now_sec();
+    n3 = scdb_make_gen_file("scdb_load_bench.cdbmake", SCDB_CDBMAKE, "scdb_load_bench.2.cdb");
+    t3 = now_sec();
+
+    if (n1 != num || n2 != num || n3 != num)
+    {
+        fprintf(stderr, "load fail: %d %d %d\n", n1, n2, n3);
+        return 1;
+    }
+
+    printf("records: %d\n", num);
+    printf("fgets:             %.3fs, %.0f records/s\n", t1 - t0, num / (t1 - t0));
+    printf("load key=value:    %.3fs, %.0f records/s\n", t2 - t1, num / (t2 - t1));
+    printf("load cdbmake:      %.3fs, %.0f records/s\n", t3 - t2, num / (t3 - t2));
+    printf("output identical:  %s\n", same_file("scdb_load_bench.1.cdb", "scdb_load_bench.2.cdb") ? "yes" : "NO");
+
+    unlink("scdb_load_bench.txt");
+    unlink("scdb_load_bench.cdbmake");
+    unlink("scdb_load_bench.0.cdb");
+    unlink("scdb_load_bench.1.cdb");
+    unlink("scdb_load_bench.2.cdb");
+    return 0;
+}
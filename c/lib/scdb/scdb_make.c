@@ -3,20 +3,67 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <zlib.h>
 #include "scdb_make.h"
 #include "utils.h"
 
 // -------------------------------------------------
 
 int scdb_make_start(struct scdb_make *c, int fd)
+{
+    return scdb_make_start_flags(c, fd, 0);
+}
+
+/**
+ * @brief   开始生成 cdb
+ * @param c     指向 struct scdb_make 对象的指针
+ * @param fd    输出文件句柄
+ * @param flags SCDB_F_* 组合, SCDB_F_64 生成 64 位格式 (突破 4 GB 限制),
+ *              SCDB_F_HASH64 改用 scdb_hash64 (需要 SCDB_F_64),
+ *              SCDB_F_ZBLOCK 值按块压缩 (需要 SCDB_F_64)
+ * @return 0:成功, -1:失败
+ */
+int scdb_make_start_flags(struct scdb_make *c, int fd, uint64_t flags)
 {
     c->head = 0;
     c->split = 0;
     c->hash = 0;
     c->numentries = 0;
+    memset(c->count, 0, sizeof(c->count));
+    c->inmem = 0;
+    c->memlimit = 0;
+    c->tmpdir = 0;
+    c->spillfd = -1;
+    c->spillpos = 0;
+    c->runs = 0;
+    c->nruns = 0;
+    c->filter_bits = SCDB_FILTER_BITS;
+    c->filter_k = 0;
+    c->filter_blocks = 0;
+    c->filter_pos = 0;
+    c->filter = 0;
+    c->zbuf = 0;
+    c->zlen = 0;
+    c->zsize = SCDB_ZBLOCK_SIZE;
+    c->zlevel = Z_DEFAULT_COMPRESSION;
+    c->zfd = -1;
+    c->zpos = 0;
+    c->zblock_pos = 0;
+    c->zout = 0;
+    c->zoutcap = 0;
     c->fd = fd;
-    c->pos = sizeof(c->final);
+    c->flags = flags;
+    c->fmt = (flags & SCDB_F_64) ? SCDB_FMT_64 : SCDB_FMT_32;
+    c->pos = (c->fmt == SCDB_FMT_64) ? SCDB64_HEADER : SCDB32_HEADER;
+
+    // filter/压缩块段的位置与 hash 类型只能记录在 64 位格式的文件头中
+    if ((flags & (SCDB_F_FILTER | SCDB_F_HASH64 | SCDB_F_ZBLOCK)) && (c->fmt != SCDB_FMT_64))
+        return -1;
 
     buffer_init(&c->b, write, fd, c->bspace, sizeof c->bspace);
 
@@ -26,16 +73,426 @@ int scdb_make_start(struct scdb_make *c, int fd)
         return 0;
 }
 
-static int posplus(struct scdb_make *c, uint32_t len)
+static int posplus(struct scdb_make *c, uint64_t len)
 {
-    uint32_t newpos = c->pos + len;
+    uint64_t newpos = c->pos + len;
     if (newpos < len)
         return -1;
+    if ((c->fmt == SCDB_FMT_32) && (newpos > 0xffffffff))
+        return -1;
     c->pos = newpos;
     return 0;
 }
 
-int scdb_make_addend(struct scdb_make *c, unsigned int keylen, unsigned int datalen, uint32_t h)
+
+/**
+ * @brief   限制生成过程中 (hash, pos) 列表占用的内存, 超出时按子表排序后写入临时文件
+ * @param c         指向 struct scdb_make 对象的指针, 在 scdb_make_start*() 之后调用
+ * @param memlimit  内存上限 (字节), 0 表示不限制
+ * @param tmpdir    临时文件目录, NULL 使用 /tmp
+ * @return 0:成功, -1:失败
+ * @note finish 时逐个子表从临时文件合并, 峰值内存约为最大子表的 3 倍 (单线程)
+ */
+int scdb_make_set_memlimit(struct scdb_make *c, uint64_t memlimit, char *tmpdir)
+{
+    if (memlimit && (memlimit < 2 * sizeof(struct scdb_hplist)))
+        return -1;
+    c->memlimit = memlimit;
+    c->tmpdir = tmpdir;
+    return 0;
+}
+
+static int allpwrite(int fd, char *buf, size_t len, uint64_t pos)
+{
+    ssize_t w;
+
+    while (len)
+    {
+        w = pwrite(fd, buf, len, (off_t)pos);
+        if (w == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += w;
+        len -= w;
+        pos += w;
+    }
+    return 0;
+}
+
+static void hplist_free(struct scdb_make *c)
+{
+    struct scdb_hplist *x;
+
+    while ((x = c->head))
+    {
+        c->head = x->next;
+        free(x);
+    }
+}
+
+/**
+ * @brief   在 c->tmpdir (默认 /tmp) 下创建临时文件, 创建后立即 unlink
+ * @return 文件句柄, -1:失败
+ */
+static int tmp_open(struct scdb_make *c)
+{
+    char fn[1024];
+    int fd;
+
+    snprintf(fn, sizeof(fn), "%s/scdb_make.XXXXXX", c->tmpdir ? c->tmpdir : "/tmp");
+    fd = mkstemp(fn);
+    if (fd != -1)
+        unlink(fn);
+    return fd;
+}
+
+/**
+ * @brief   把内存中的 (hash, pos) 按子表计数排序后写入临时文件, 作为一个 run
+ * @note 每个子表内保持插入顺序, run 按时间顺序追加, 所以合并结果与全内存构建相同
+ */
+static int spill(struct scdb_make *c)
+{
+    uint64_t cnt[256];
+    uint64_t end[256];
+    uint64_t u;
+    struct scdb_hplist *x;
+    struct scdb_hp *tmp;
+    struct scdb_run *runs;
+    int i;
+
+    if (!c->inmem)
+        return 0;
+
+    if (c->spillfd == -1)
+    {
+        c->spillfd = tmp_open(c);
+        if (c->spillfd == -1)
+            return -1;
+    }
+
+    runs = (struct scdb_run *)realloc(c->runs, (c->nruns + 1) * sizeof(struct scdb_run));
+    if (!runs)
+        return -1;
+    c->runs = runs;
+
+    tmp = (struct scdb_hp *)malloc(c->inmem * sizeof(struct scdb_hp));
+    if (!tmp)
+        return -1;
+
+    memset(cnt, 0, sizeof(cnt));
+    for (x = c->head; x; x = x->next)
+        for (i = 0; i < x->num; ++i)
+            ++cnt[255 & x->hp[i].h];
+
+    u = 0;
+    for (i = 0; i < 256; ++i)
+    {
+        runs[c->nruns].off[i] = c->spillpos + u * sizeof(struct scdb_hp);
+        runs[c->nruns].cnt[i] = cnt[i];
+        u += cnt[i];
+        end[i] = u;
+    }
+
+    for (x = c->head; x; x = x->next)
+    {
+        i = x->num;
+        while (i--)
+            tmp[--end[255 & x->hp[i].h]] = x->hp[i];
+    }
+
+    if (allpwrite(c->spillfd, (char *)tmp, c->inmem * sizeof(struct scdb_hp), c->spillpos) == -1)
+    {
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+
+    c->spillpos += c->inmem * sizeof(struct scdb_hp);
+    ++c->nruns;
+    c->inmem = 0;
+    hplist_free(c);
+
+    return 0;
+}
+
+/**
+ * @brief   从所有 run 中按顺序读出第 i 张子表的条目
+ */
+static int spill_load(struct scdb_make *c, int i, struct scdb_hp *hp)
+{
+    int r;
+    size_t len;
+
+    for (r = 0; r < c->nruns; ++r)
+    {
+        len = c->runs[r].cnt[i] * sizeof(struct scdb_hp);
+        if (!len)
+            continue;
+        if (pread(c->spillfd, (char *)hp, len, (off_t)c->runs[r].off[i]) != (ssize_t)len)
+            return -1;
+        hp += c->runs[r].cnt[i];
+    }
+
+    return 0;
+}
+
+static void spill_free(struct scdb_make *c)
+{
+    if (c->spillfd != -1)
+    {
+        close(c->spillfd);
+        c->spillfd = -1;
+    }
+    if (c->runs)
+    {
+        free(c->runs);
+        c->runs = 0;
+    }
+    c->nruns = 0;
+    c->spillpos = 0;
+}
+
+/**
+ * @brief   设置 Bloom filter 每个 key 占用的 bit 数, 0 表示不生成 filter
+ * @param c             指向 struct scdb_make 对象的指针, 必须是 SCDB_F_64 格式
+ * @param bits_per_key  每个 key 的 bit 数, 10 约 1% 误判, 16 约 0.1%
+ * @return 0:成功, -1:失败
+ */
+int scdb_make_set_filter(struct scdb_make *c, unsigned int bits_per_key)
+{
+    if (c->fmt != SCDB_FMT_64)
+        return -1;
+
+    if (bits_per_key)
+    {
+        c->flags |= SCDB_F_FILTER;
+        c->filter_bits = bits_per_key;
+    }
+    else
+        c->flags &= ~(uint64_t)SCDB_F_FILTER;
+
+    return 0;
+}
+
+static int filter_prepare(struct scdb_make *c)
+{
+    if (!(c->flags & SCDB_F_FILTER))
+        return 0;
+
+    // k = bits_per_key * ln2 时误判率最低
+    c->filter_k = (c->filter_bits * 69 + 50) / 100;
+    if (c->filter_k < 1)
+        c->filter_k = 1;
+    if (c->filter_k > 16)
+        c->filter_k = 16;
+
+    c->filter_blocks = (c->numentries * c->filter_bits + SCDB_FILTER_BLOCK * 8 - 1) / (SCDB_FILTER_BLOCK * 8);
+    if (!c->filter_blocks)
+        c->filter_blocks = 1;
+
+    c->filter = (char *)calloc(c->filter_blocks, SCDB_FILTER_BLOCK);
+    if (!c->filter)
+        return -1;
+
+    return 0;
+}
+
+static void filter_fill(struct scdb_make *c, struct scdb_hp *hp, uint64_t count)
+{
+    uint64_t u;
+
+    if (!c->filter)
+        return;
+    for (u = 0; u < count; ++u)
+        scdb_filter_add(c->filter, c->filter_blocks, c->filter_k, hp[u].h);
+}
+
+static void filter_free(struct scdb_make *c)
+{
+    if (c->filter)
+    {
+        free(c->filter);
+        c->filter = 0;
+    }
+}
+
+/**
+ * @brief   设置压缩块参数, 需要以 SCDB_F_ZBLOCK 开始
+ * @param block_size    每块的原始字节数, 0 为 SCDB_ZBLOCK_SIZE; 块越大压缩率越高, 读取一个值要解压的数据也越多
+ * @param level         zlib 压缩级别 1-9, -1 为默认
+ * @return 0:成功, -1:失败
+ */
+int scdb_make_set_zblock(struct scdb_make *c, unsigned int block_size, int level)
+{
+    if (!(c->flags & SCDB_F_ZBLOCK) || c->zbuf)
+        return -1;
+    if (level < -1 || level > 9)
+        return -1;
+
+    c->zsize = block_size ? block_size : SCDB_ZBLOCK_SIZE;
+    c->zlevel = level;
+    return 0;
+}
+
+/**
+ * @brief   压缩一块并追加到临时文件: 原始长度(4) + 压缩长度(4) + zlib 数据
+ */
+static int zblock_write(struct scdb_make *c, char *data, unsigned int len)
+{
+    unsigned long clen = compressBound(len);
+    char *out;
+
+    if (c->zfd == -1)
+    {
+        c->zfd = tmp_open(c);
+        if (c->zfd == -1)
+            return -1;
+    }
+    if (clen + 8 > c->zoutcap)
+    {
+        out = (char *)realloc(c->zout, clen + 8);
+        if (!out)
+            return -1;
+        c->zout = out;
+        c->zoutcap = clen + 8;
+    }
+
+    if (compress2((Bytef *)c->zout + 8, &clen, (Bytef *)data, len, c->zlevel) != Z_OK)
+        return -1;
+    if (clen > 0xffffffff)
+        return -1;
+    uint32_pack(c->zout, len);
+    uint32_pack(c->zout + 4, clen);
+    if (allpwrite(c->zfd, c->zout, clen + 8, c->zpos) == -1)
+        return -1;
+    c->zpos += clen + 8;
+
+    return 0;
+}
+
+static int zblock_flush(struct scdb_make *c)
+{
+    if (!c->zlen)
+        return 0;
+    if (zblock_write(c, c->zbuf, c->zlen) == -1)
+        return -1;
+    c->zlen = 0;
+    return 0;
+}
+
+/**
+ * @brief   SCDB_F_ZBLOCK: 值放入当前块, 记录中只写 16 字节的引用
+ */
+static int zblock_add(struct scdb_make *c, char *key, unsigned int keylen, char *data, unsigned int datalen)
+{
+    char ref[SCDB_ZREF];
+
+    if (!c->zbuf)
+    {
+        c->zbuf = (char *)malloc(c->zsize);
+        if (!c->zbuf)
+            return -1;
+    }
+    if (c->zlen && datalen > c->zsize - c->zlen)
+        if (zblock_flush(c) == -1)
+            return -1;
+
+    uint64_pack(ref, c->zpos);
+    uint32_pack(ref + 8, c->zlen);
+    uint32_pack(ref + 12, datalen);
+
+    if (datalen > c->zsize)
+    {
+        if (zblock_write(c, data, datalen) == -1)
+            return -1;
+    }
+    else
+    {
+        memcpy(c->zbuf + c->zlen, data, datalen);
+        c->zlen += datalen;
+    }
+
+    if (scdb_make_addbegin(c, keylen, SCDB_ZREF) == -1)
+        return -1;
+    if (buffer_putalign(&c->b, key, keylen) == -1)
+        return -1;
+    if (buffer_putalign(&c->b, ref, SCDB_ZREF) == -1)
+        return -1;
+    return scdb_make_addend(c, keylen, SCDB_ZREF, scdb_keyhash(c->flags, key, keylen));
+}
+
+static void zblock_free(struct scdb_make *c)
+{
+    if (c->zfd != -1)
+    {
+        close(c->zfd);
+        c->zfd = -1;
+    }
+    if (c->zbuf)
+    {
+        free(c->zbuf);
+        c->zbuf = 0;
+    }
+    if (c->zout)
+    {
+        free(c->zout);
+        c->zout = 0;
+    }
+    c->zoutcap = 0;
+}
+
+/**
+ * @brief   把压缩块段从临时文件复制到输出文件的 c->pos 处
+ * @note 调用前 c->b 中的数据须已写出
+ */
+static int zblock_finish(struct scdb_make *c)
+{
+    char buf[65536];
+    uint64_t off;
+    ssize_t r;
+
+    if (!(c->flags & SCDB_F_ZBLOCK))
+        return 0;
+    if (zblock_flush(c) == -1)
+        return -1;
+
+    c->zblock_pos = c->pos;
+    for (off = 0; off < c->zpos; off += r)
+    {
+        r = pread(c->zfd, buf, sizeof(buf), (off_t)off);
+        if (r <= 0)
+            return -1;
+        if (allpwrite(c->fd, buf, r, c->pos + off) == -1)
+            return -1;
+    }
+    c->pos += c->zpos;
+    zblock_free(c);
+
+    return 0;
+}
+
+/**
+ * @brief   填写 64 位格式的文件头: magic, flags, 以及可选段的位置
+ */
+static void final_preamble(struct scdb_make *c)
+{
+    memset(c->final, 0, SCDB64_PREAMBLE);
+    memcpy(c->final, SCDB64_MAGIC, SCDB64_MAGIC_LEN);
+    uint64_pack(c->final + 8, c->flags);
+    if (c->flags & SCDB_F_FILTER)
+    {
+        uint64_pack(c->final + SCDB64_OFF_FILTER_POS, c->filter_pos);
+        uint64_pack(c->final + SCDB64_OFF_FILTER_BLOCKS, c->filter_blocks);
+        uint32_pack(c->final + SCDB64_OFF_FILTER_K, c->filter_k);
+    }
+    if (c->flags & SCDB_F_ZBLOCK)
+        uint64_pack(c->final + SCDB64_OFF_ZBLOCK_POS, c->zblock_pos);
+}
+
+int scdb_make_addend(struct scdb_make *c, unsigned int keylen, unsigned int datalen, uint64_t h)
 {
     struct scdb_hplist *head;
     head = c->head;
@@ -52,6 +509,12 @@ int scdb_make_addend(struct scdb_make *c, unsigned int keylen, unsigned int data
     head->hp[head->num].p = c->pos;
     ++head->num;
     ++c->numentries;
+    ++c->count[255 & h];
+    ++c->inmem;
+    // 内存中的列表加上 spill 时的排序缓冲共占 2 份
+    if (c->memlimit && (c->inmem * 2 * sizeof(struct scdb_hp) >= c->memlimit))
+        if (spill(c) == -1)
+            return -1;
     if (posplus(c, 8) == -1)
         return -1;
     if (posplus(c, keylen) == -1)
@@ -80,37 +543,37 @@ int scdb_make_add(struct scdb_make *c,
                   char *key, unsigned int keylen,
                   char *data, unsigned int datalen)
 {
+    if (c->flags & SCDB_F_ZBLOCK)
+        return zblock_add(c, key, keylen, data, datalen);
+
     if (scdb_make_addbegin(c, keylen, datalen) == -1)
         return -1;
     if (buffer_putalign(&c->b, key, keylen) == -1)
         return -1;
     if (buffer_putalign(&c->b, data, datalen) == -1)
         return -1;
-    return scdb_make_addend(c, keylen, datalen, scdb_hash(key, keylen));
+    return scdb_make_addend(c, keylen, datalen, scdb_keyhash(c->flags, key, keylen));
 }
 
 int scdb_make_finish(struct scdb_make *c)
 {
-    char buf[8];
+    char buf[16];
     int i;
-    uint32_t len;
-    uint32_t u;
-    uint32_t memsize;
-    uint32_t count;
-    uint32_t where;
+    uint64_t len;
+    uint64_t u;
+    uint64_t memsize;
+    uint64_t count;
+    uint64_t where;
+    unsigned int slotsize;
+    unsigned int finalsize;
     struct scdb_hplist *x;
     struct scdb_hp *hp;
 
-    for (i = 0; i < 256; ++i)
-        c->count[i] = 0;
-
-    for (x = c->head; x; x = x->next)
-    {
-        i = x->num;
-        while (i--)
-            ++c->count[255 & x->hp[i].h];
-    }
+    // 已经落盘的, 逐个子表从临时文件合并
+    if (c->nruns)
+        return scdb_make_finish_mt(c, 1);
 
+    // c->count 已在 scdb_make_addend 中累计
     memsize = 1;
     for (i = 0; i < 256; ++i)
     {
@@ -120,7 +583,7 @@ int scdb_make_finish(struct scdb_make *c)
     }
 
     memsize += c->numentries; // no overflow possible up to now
-    u = (uint32_t)0 - (uint32_t)1;
+    u = (size_t)0 - (size_t)1;
     u /= sizeof(struct scdb_hp);
     if (memsize > u)
         return -1;
@@ -145,18 +608,41 @@ int scdb_make_finish(struct scdb_make *c)
             c->split[--c->start[255 & x->hp[i].h]] = x->hp[i];
     }
 
+    if (c->fmt == SCDB_FMT_64)
+    {
+        slotsize = 16;
+        finalsize = SCDB64_HEADER;
+    }
+    else
+    {
+        slotsize = 8;
+        finalsize = SCDB32_HEADER;
+    }
+
+    if (filter_prepare(c) == -1)
+        return -1;
+
     for (i = 0; i < 256; ++i)
     {
         count = c->count[i];
 
         len = count + count; // no overflow possible
-        uint32_pack(c->final + 8 * i, c->pos);
-        uint32_pack(c->final + 8 * i + 4, len);
+        if (c->fmt == SCDB_FMT_64)
+        {
+            uint64_pack(c->final + SCDB64_PREAMBLE + 16 * i, c->pos);
+            uint64_pack(c->final + SCDB64_PREAMBLE + 16 * i + 8, len);
+        }
+        else
+        {
+            uint32_pack(c->final + 8 * i, c->pos);
+            uint32_pack(c->final + 8 * i + 4, len);
+        }
 
         for (u = 0; u < len; ++u)
             c->hash[u].h = c->hash[u].p = 0;
 
         hp = c->split + c->start[i];
+        filter_fill(c, hp, count);
         for (u = 0; u < count; ++u)
         {
             where = (hp->h >> 8) % len;
@@ -168,66 +654,628 @@ int scdb_make_finish(struct scdb_make *c)
 
         for (u = 0; u < len; ++u)
         {
-            uint32_pack(buf, c->hash[u].h);
-            uint32_pack(buf + 4, c->hash[u].p);
-            if (buffer_putalign(&c->b, buf, 8) == -1)
+            if (c->fmt == SCDB_FMT_64)
+            {
+                uint64_pack(buf, c->hash[u].h);
+                uint64_pack(buf + 8, c->hash[u].p);
+            }
+            else
+            {
+                uint32_pack(buf, c->hash[u].h);
+                uint32_pack(buf + 4, c->hash[u].p);
+            }
+            if (buffer_putalign(&c->b, buf, slotsize) == -1)
                 return -1;
-            if (posplus(c, 8) == -1)
+            if (posplus(c, slotsize) == -1)
                 return -1;
         }
     }
 
+    if (c->filter)
+    {
+        // filter 段按 64 字节对齐, 一个块正好一个 cache line
+        memset(buf, 0, sizeof(buf));
+        while (c->pos & (SCDB_FILTER_BLOCK - 1))
+        {
+            u = SCDB_FILTER_BLOCK - (c->pos & (SCDB_FILTER_BLOCK - 1));
+            if (u > sizeof(buf))
+                u = sizeof(buf);
+            if (buffer_putalign(&c->b, buf, u) == -1)
+                return -1;
+            if (posplus(c, u) == -1)
+                return -1;
+        }
+        c->filter_pos = c->pos;
+        for (u = 0; u < c->filter_blocks; ++u)
+            if (buffer_putalign(&c->b, c->filter + u * SCDB_FILTER_BLOCK, SCDB_FILTER_BLOCK) == -1)
+                return -1;
+        if (posplus(c, c->filter_blocks * SCDB_FILTER_BLOCK) == -1)
+            return -1;
+        filter_free(c);
+    }
+    if (c->flags & SCDB_F_ZBLOCK)
+    {
+        if (buffer_flush(&c->b) == -1)
+            return -1;
+        if (zblock_finish(c) == -1)
+            return -1;
+    }
+    if (c->fmt == SCDB_FMT_64)
+        final_preamble(c);
+
+    free(c->split);
+    c->split = c->hash = 0;
+    hplist_free(c);
+
     if (buffer_flush(&c->b) == -1)
         return -1;
     if (lseek(c->fd, 0, SEEK_SET) == -1)
         return -1;
 
-    return buffer_putflush(&c->b, c->final, sizeof(c->final));
+    return buffer_putflush(&c->b, c->final, finalsize);
+}
+
+// -------------------------------------------------
+// 多线程 finish: 按 hash 低 8 位把 256 张子表分给多个线程构建
+
+struct scdb_make_mt
+{
+    struct scdb_make *c;
+    struct scdb_hplist **chunks; // 按插入顺序排列的 hplist 块
+    uint64_t nchunks;
+    int nthreads;
+    uint64_t (*cnt)[256];        // 每个线程每个子表的条目数
+    uint64_t tpos[257];          // 每张子表在文件中的位置
+    uint64_t maxlen;             // 最大子表的槽数
+    unsigned int slotsize;
+    int next;                    // 下一个待构建的子表
+    int err;
+};
+
+struct scdb_make_mt_arg
+{
+    struct scdb_make_mt *m;
+    int id;
+};
+
+static void mt_range(struct scdb_make_mt *m, int id, uint64_t *from, uint64_t *to)
+{
+    *from = m->nchunks * id / m->nthreads;
+    *to = m->nchunks * (id + 1) / m->nthreads;
+}
+
+static void *mt_count(void *arg)
+{
+    struct scdb_make_mt_arg *a = (struct scdb_make_mt_arg *)arg;
+    struct scdb_make_mt *m = a->m;
+    uint64_t *cnt = m->cnt[a->id];
+    uint64_t k, from, to;
+    int i;
+
+    mt_range(m, a->id, &from, &to);
+    for (k = from; k < to; ++k)
+        for (i = 0; i < m->chunks[k]->num; ++i)
+            ++cnt[255 & m->chunks[k]->hp[i].h];
+
+    return 0;
+}
+
+static void *mt_split(void *arg)
+{
+    struct scdb_make_mt_arg *a = (struct scdb_make_mt_arg *)arg;
+    struct scdb_make_mt *m = a->m;
+    struct scdb_hp *split = m->c->split;
+    uint64_t *off = m->cnt[a->id]; // 已被转换为写入偏移
+    uint64_t k, from, to;
+    int i;
+
+    mt_range(m, a->id, &from, &to);
+    for (k = from; k < to; ++k)
+        for (i = 0; i < m->chunks[k]->num; ++i)
+            split[off[255 & m->chunks[k]->hp[i].h]++] = m->chunks[k]->hp[i];
+
+    return 0;
+}
+
+static void *mt_build(void *arg)
+{
+    struct scdb_make_mt_arg *a = (struct scdb_make_mt_arg *)arg;
+    struct scdb_make_mt *m = a->m;
+    struct scdb_make *c = m->c;
+    struct scdb_hp *hash = 0;
+    struct scdb_hp *bucket = 0;
+    struct scdb_hp *hp;
+    char *out = 0;
+    char *o;
+    uint64_t len, count, u, where;
+    int i;
+
+    hash = (struct scdb_hp *)malloc(m->maxlen * sizeof(struct scdb_hp));
+    out = (char *)malloc(m->maxlen * m->slotsize);
+    if (!hash || !out)
+        goto FAIL;
+    if (c->nruns)
+    {
+        bucket = (struct scdb_hp *)malloc((m->maxlen / 2 + 1) * sizeof(struct scdb_hp));
+        if (!bucket)
+            goto FAIL;
+    }
+
+    while (!m->err && (i = __sync_fetch_and_add(&m->next, 1)) < 256)
+    {
+        count = c->count[i];
+        len = count + count;
+        if (!len)
+            continue;
+
+        memset(hash, 0, len * sizeof(struct scdb_hp));
+
+        if (c->nruns)
+        {
+            if (spill_load(c, i, bucket) == -1)
+                goto FAIL;
+            hp = bucket;
+        }
+        else
+            hp = c->split + c->start[i];
+        filter_fill(c, hp, count);
+        for (u = 0; u < count; ++u)
+        {
+            where = (hp->h >> 8) % len;
+            while (hash[where].p)
+                if (++where == len)
+                    where = 0;
+            hash[where] = *hp++;
+        }
+
+        for (u = 0, o = out; u < len; ++u, o += m->slotsize)
+        {
+            if (m->slotsize == 16)
+            {
+                uint64_pack(o, hash[u].h);
+                uint64_pack(o + 8, hash[u].p);
+            }
+            else
+            {
+                uint32_pack(o, hash[u].h);
+                uint32_pack(o + 4, hash[u].p);
+            }
+        }
+
+        if (allpwrite(c->fd, out, len * m->slotsize, m->tpos[i]) == -1)
+            goto FAIL;
+    }
+
+    free(hash);
+    free(out);
+    if (bucket)
+        free(bucket);
+    return 0;
+
+FAIL:
+    m->err = 1;
+    if (hash)
+        free(hash);
+    if (out)
+        free(out);
+    if (bucket)
+        free(bucket);
+    return 0;
+}
+
+static int mt_run(struct scdb_make_mt *m, void *(*fn)(void *))
+{
+    pthread_t tid[m->nthreads];
+    struct scdb_make_mt_arg args[m->nthreads];
+    int i, n;
+
+    for (n = 0; n < m->nthreads; ++n)
+    {
+        args[n].m = m;
+        args[n].id = n;
+        if (pthread_create(&tid[n], NULL, fn, &args[n]) != 0)
+        {
+            m->err = 1;
+            break;
+        }
+    }
+    for (i = 0; i < n; ++i)
+        pthread_join(tid[i], NULL);
+
+    return m->err ? -1 : 0;
+}
+
+/**
+ * @brief   多线程版本的 scdb_make_finish, 生成的文件与单线程版本逐字节相同
+ * @param c         指向 struct scdb_make 对象的指针
+ * @param nthreads  线程数, <= 1 时等同于 scdb_make_finish
+ * @return 0:成功, -1:失败
+ * @note 子表写入使用 pwrite, 各线程互不干扰; header 最后由调用线程写入.
+ *       设置了 scdb_make_set_memlimit 且已落盘时, 每个线程从临时文件读入自己的子表
+ */
+int scdb_make_finish_mt(struct scdb_make *c, int nthreads)
+{
+    struct scdb_make_mt m;
+    struct scdb_hplist *x;
+    uint64_t k, u, sum;
+    unsigned int finalsize;
+    int i, t;
+
+    if ((nthreads <= 1) && !c->nruns)
+        return scdb_make_finish(c);
+    if (nthreads < 1)
+        nthreads = 1;
+
+    memset(&m, 0, sizeof(m));
+    m.c = c;
+    m.nthreads = nthreads;
+    m.slotsize = (c->fmt == SCDB_FMT_64) ? 16 : 8;
+    finalsize = (c->fmt == SCDB_FMT_64) ? SCDB64_HEADER : SCDB32_HEADER;
+
+    for (x = c->head; x; x = x->next)
+        ++m.nchunks;
+
+    m.maxlen = 1;
+    for (i = 0; i < 256; ++i)
+        if (c->count[i] * 2 > m.maxlen)
+            m.maxlen = c->count[i] * 2;
+
+    u = (size_t)0 - (size_t)1;
+    u /= sizeof(struct scdb_hp);
+    if ((c->numentries > u) || (m.maxlen > u))
+        return -1;
+
+    if (c->nruns)
+    {
+        // 剩余的也写入临时文件, 之后各子表全部从 run 中读取
+        if (spill(c) == -1)
+            goto FAIL;
+    }
+    else
+    {
+        c->split = (struct scdb_hp *)malloc((c->numentries ? c->numentries : 1) * sizeof(struct scdb_hp));
+        m.chunks = (struct scdb_hplist **)malloc((m.nchunks ? m.nchunks : 1) * sizeof(struct scdb_hplist *));
+        m.cnt = calloc(nthreads, sizeof(*m.cnt));
+        if (!c->split || !m.chunks || !m.cnt)
+            goto FAIL;
+
+        // c->head 是倒序链表, 转成插入顺序, 保证每张子表内条目顺序与单线程版本一致
+        k = m.nchunks;
+        for (x = c->head; x; x = x->next)
+            m.chunks[--k] = x;
+
+        if (mt_run(&m, mt_count) == -1)
+            goto FAIL;
+
+        // 子表起点, 以及每个线程在每张子表内的写入偏移
+        sum = 0;
+        for (i = 0; i < 256; ++i)
+        {
+            c->start[i] = sum;
+            for (t = 0; t < nthreads; ++t)
+            {
+                u = m.cnt[t][i];
+                m.cnt[t][i] = sum;
+                sum += u;
+            }
+        }
+
+        if (mt_run(&m, mt_split) == -1)
+            goto FAIL;
+    }
+
+    // 记录区写完后才是 hash 表, 位置可以提前算出
+    if (buffer_flush(&c->b) == -1)
+        goto FAIL;
+    m.tpos[0] = c->pos;
+    for (i = 0; i < 256; ++i)
+    {
+        m.tpos[i + 1] = m.tpos[i] + c->count[i] * 2 * m.slotsize;
+        if (m.tpos[i + 1] < m.tpos[i])
+            goto FAIL;
+    }
+    if ((c->fmt == SCDB_FMT_32) && (m.tpos[256] > 0xffffffff))
+        goto FAIL;
+
+    if (filter_prepare(c) == -1)
+        goto FAIL;
+    if (mt_run(&m, mt_build) == -1)
+        goto FAIL;
+
+    c->pos = m.tpos[256];
+    if (c->filter)
+    {
+        // 与单线程版本相同, 对齐的空隙写 0; 文件可能不是新截断的, 不能依赖空洞
+        c->filter_pos = (c->pos + SCDB_FILTER_BLOCK - 1) & ~(uint64_t)(SCDB_FILTER_BLOCK - 1);
+        if (c->filter_pos > c->pos)
+        {
+            char zero[SCDB_FILTER_BLOCK] = {0};
+
+            if (allpwrite(c->fd, zero, c->filter_pos - c->pos, c->pos) == -1)
+                goto FAIL;
+        }
+        if (allpwrite(c->fd, c->filter, c->filter_blocks * SCDB_FILTER_BLOCK, c->filter_pos) == -1)
+            goto FAIL;
+        c->pos = c->filter_pos + c->filter_blocks * SCDB_FILTER_BLOCK;
+        filter_free(c);
+    }
+    if (zblock_finish(c) == -1)
+        goto FAIL;
+    if (c->fmt == SCDB_FMT_64)
+        final_preamble(c);
+    for (i = 0; i < 256; ++i)
+    {
+        if (c->fmt == SCDB_FMT_64)
+        {
+            uint64_pack(c->final + SCDB64_PREAMBLE + 16 * i, m.tpos[i]);
+            uint64_pack(c->final + SCDB64_PREAMBLE + 16 * i + 8, c->count[i] * 2);
+        }
+        else
+        {
+            uint32_pack(c->final + 8 * i, m.tpos[i]);
+            uint32_pack(c->final + 8 * i + 4, c->count[i] * 2);
+        }
+    }
+    if (m.chunks)
+        free(m.chunks);
+    if (m.cnt)
+        free(m.cnt);
+    if (c->split)
+        free(c->split);
+    c->split = 0;
+    hplist_free(c);
+    spill_free(c);
+
+    if (lseek(c->fd, (off_t)c->pos, SEEK_SET) == -1)
+        return -1;
+    return allpwrite(c->fd, c->final, finalsize, 0);
+
+FAIL:
+    if (m.chunks)
+        free(m.chunks);
+    if (m.cnt)
+        free(m.cnt);
+    if (c->split)
+        free(c->split);
+    c->split = 0;
+    hplist_free(c);
+    filter_free(c);
+    spill_free(c);
+    zblock_free(c);
+    return -1;
+}
+
+/**
+ * @brief   解析 key<sep>value 行, 去掉行尾的 '\n', 没有 sep 的行被跳过
+ * @param eof   buf 之后没有更多数据, 此时最后一行可以没有换行符
+ * @return 已处理的字节数 (只处理完整的行), -1:失败
+ */
+static int64_t load_lines(struct scdb_make *c, char *buf, uint64_t len, char sep, int eof, int *num)
+{
+    char *p = buf, *end = buf + len, *nl, *le, *tok;
+
+    while (p < end)
+    {
+        nl = (char *)memchr(p, '\n', end - p);
+        if (!nl && !eof)
+            break;
+        le = nl ? nl : end;
+
+        tok = (char *)memchr(p, sep, le - p);
+        if (tok)
+        {
+            if (tok - p > 0xffffffff || le - tok - 1 > 0xffffffff)
+                return -1;
+            if (scdb_make_add(c, p, tok - p, tok + 1, le - tok - 1) == -1)
+                return -1;
+            ++*num;
+        }
+
+        p = nl ? nl + 1 : end;
+    }
+
+    return p - buf;
+}
+
+/**
+ * @brief   解析以 term 结尾的十进制长度
+ * @return 1:成功, 0:数据不完整, -1:格式错误
+ */
+static int load_num(char **pp, char *end, char term, uint64_t *n)
+{
+    char *p = *pp;
+
+    *n = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        *n = *n * 10 + (*p - '0');
+        if (*n > 0xffffffff)
+            return -1;
+        ++p;
+    }
+    if (p == end)
+        return 0;
+    if (p == *pp || *p != term)
+        return -1;
+
+    *pp = p + 1;
+    return 1;
+}
+
+/**
+ * @brief   解析 cdbmake 格式: +klen,dlen:key->data\n, 以空行结束
+ * @param done  输出, 读到结束的空行时置 1
+ * @return 已处理的字节数 (只处理完整的记录), -1:失败
+ * @note key 与 data 按长度读取, 可以包含任意字节
+ */
+static int64_t load_cdbmake(struct scdb_make *c, char *buf, uint64_t len, int eof, int *num, int *done)
+{
+    char *p = buf, *end = buf + len, *q;
+    uint64_t klen, dlen;
+    int ret;
+
+    while (p < end)
+    {
+        if (*p == '\n')
+        {
+            *done = 1;
+            return p + 1 - buf;
+        }
+        if (*p != '+')
+            return -1;
+
+        q = p + 1;
+        ret = load_num(&q, end, ',', &klen);
+        if (ret == 1)
+            ret = load_num(&q, end, ':', &dlen);
+        if (ret == -1)
+            return -1;
+        if (ret == 0 || (uint64_t)(end - q) < klen + 2 + dlen + 1)
+        {
+            if (eof)
+                return -1;
+            break;
+        }
+
+        if (q[klen] != '-' || q[klen + 1] != '>' || q[klen + 2 + dlen] != '\n')
+            return -1;
+        if (scdb_make_add(c, q, klen, q + klen + 2, dlen) == -1)
+            return -1;
+        ++*num;
+
+        p = q + klen + 2 + dlen + 1;
+    }
+
+    return p - buf;
+}
+
+static int64_t load_buf(struct scdb_make *c, char *buf, uint64_t len, char sep, int eof, int *num, int *done)
+{
+    if (sep == SCDB_CDBMAKE)
+        return load_cdbmake(c, buf, len, eof, num, done);
+    return load_lines(c, buf, len, sep, eof, num);
+}
+
+/**
+ * @brief   把文件 fn 中的记录全部加入 c
+ * @param c     scdb_make_start*() 开始的对象
+ * @param fn    输入文件, 每行 key<sep>value; sep 为 SCDB_CDBMAKE 时按 cdbmake 格式解析
+ * @return 加入的记录数, -1:失败
+ * @note 普通文件整体 mmap, 其它 (管道等) 按 SCDB_LOAD_BLOCK 分块读取; 行与记录长度不受限制,
+ *       用 memchr 查找换行与分隔符
+ */
+int scdb_make_load(struct scdb_make *c, char *fn, char sep)
+{
+    struct stat st;
+    char *map, *buf = NULL, *nbuf;
+    uint64_t len = 0, cap = SCDB_LOAD_BLOCK;
+    int64_t n;
+    ssize_t r;
+    int fd, num = 0, eof = 0, done = 0;
+
+    fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1)
+        goto FAIL;
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        map = (char *)mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            goto FAIL;
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+        n = load_buf(c, map, st.st_size, sep, 1, &num, &done);
+        munmap(map, st.st_size);
+        if (n == -1)
+            goto FAIL;
+
+        close(fd);
+        return num;
+    }
+
+    buf = (char *)malloc(cap);
+    if (!buf)
+        goto FAIL;
+
+    while (!eof && !done)
+    {
+        // 缓冲区里是一条未读完的记录, 扩大后继续读
+        if (len == cap)
+        {
+            nbuf = (char *)realloc(buf, cap * 2);
+            if (!nbuf)
+                goto FAIL;
+            buf = nbuf;
+            cap *= 2;
+        }
+
+        r = read(fd, buf + len, cap - len);
+        if (r == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            goto FAIL;
+        }
+        if (r == 0)
+            eof = 1;
+        len += r;
+
+        n = load_buf(c, buf, len, sep, eof, &num, &done);
+        if (n == -1)
+            goto FAIL;
+        memmove(buf, buf + n, len - n);
+        len -= n;
+    }
+
+    free(buf);
+    close(fd);
+    return num;
+
+FAIL:
+    if (buf)
+        free(buf);
+    close(fd);
+    return -1;
 }
 
 /**
  * @brief   把文件 fn 生成对应的 cdb 文件
  * @param fn        需要被生成的文件
- * @param sep       文件内每行按什么分隔区分key与val, (name=value, sep is =)
+ * @param sep       文件内每行按什么分隔区分key与val, (name=value, sep is =);
+ *                  SCDB_CDBMAKE 表示 cdbmake 格式 (+klen,dlen:key->data)
  * @param cdb_fn    生成的 cdb 文件名
  * @return -1:fail, 返回生成的行数.
  */
 int scdb_make_gen_file(char *fn, char sep, char *cdb_fn)
+{
+    return scdb_make_gen_file_flags(fn, sep, cdb_fn, 0);
+}
+
+/**
+ * @brief   同 scdb_make_gen_file, 可指定生成格式
+ * @param flags SCDB_F_* 组合, 如 SCDB_F_64
+ */
+int scdb_make_gen_file_flags(char *fn, char sep, char *cdb_fn, uint64_t flags)
 {
     struct scdb_make c;
     char cdb_fn_temp[1024] = {0};
-    char *tok = NULL;
     int fd = -1;
-    FILE *fp = NULL;
     int num = 0;
 
-    fp = fopen(fn, "r");
-    if (!fp)
+    if (access(fn, R_OK) == -1)
         return -1;
 
     snprintf(cdb_fn_temp, sizeof(cdb_fn_temp), "%s.tmp", cdb_fn);
     fd = open(cdb_fn_temp, O_WRONLY | O_NDELAY | O_TRUNC | O_CREAT, 0644);
     if (fd == -1)
         goto SFAIL;
-    if (scdb_make_start(&c, fd) == -1)
+    if (scdb_make_start_flags(&c, fd, flags) == -1)
         goto SFAIL;
 
-    char buf[4096] = {0};
-    while (fgets(buf, sizeof(buf), fp) != NULL)
-    {
-        tok = (char *)memchr(buf, sep, strlen(buf));
-        if (!tok)
-            continue;
-
-        *tok = '\0';
-
-        if (scdb_make_add(&c, buf, strlen(buf), tok + 1, strlen(tok + 1)) == -1)
-            goto SFAIL;
-
-        num++;
-    }
-
-    if (!feof(fp))
+    num = scdb_make_load(&c, fn, sep);
+    if (num == -1)
         goto SFAIL;
 
     if (scdb_make_finish(&c) == -1)
@@ -238,14 +1286,11 @@ int scdb_make_gen_file(char *fn, char sep, char *cdb_fn)
     if (rename(cdb_fn_temp, cdb_fn))
         goto SFAIL;
 
-    fclose(fp);
     close(fd);
 
     return num;
 
 SFAIL:
-    if (fp != NULL)
-        fclose(fp);
     if (fd != -1)
         close(fd);
 
@@ -3,6 +3,7 @@
  *   - 快速查找：在大型数据库中成功查找通常只需要两次磁盘访问。不成功的查找只需要一个。
  *   - 低开销：数据库使用 2048 字节，加上每条记录 24 字节，加上键和数据的空间。
  *   - 没有随机限制： cdb 可以处理最大 4 GB 的任何数据库。没有其他限制；记录甚至不必放入内存。数据库以与机器无关的格式存储。
+ *     使用 scdb_make_start_flags(c, fd, SCDB_F_64) 生成 64 位格式, 突破 4 GB 限制, 读取端自动识别两种格式。
  *   - 快速原子数据库替换： cdbmake 可以比其他散列包快两个数量级地重写整个数据库。
  *   - 快速数据库转储： cdbdump 以与 cdbmake 兼容的格式打印数据库的内容。
  * cdb 旨在用于电子邮件等关键任务应用程序。数据库替换对于系统崩溃是安全的。读者不必在重写期间暂停。
@@ -17,6 +18,11 @@
  *      version=1.0
  *      name=cdb_test
  *      email=kyosold@qq.com
+ *
+ * 也支持 cdbmake 格式 (sep 传 SCDB_CDBMAKE), key 与 value 可包含任意字节:
+ *      +7,3:version->1.0
+ *      +4,8:name->cdb_test
+ *
  * 
  * 
  */
@@ -26,13 +32,17 @@
 
 #include <stdint.h>
 #include "buffer.h"
+#include "utils.h"
 
 #define SCDB_HPLIST 1000
 
+#define SCDB_CDBMAKE '\0'          // 作为 sep 传入时按 cdbmake 格式 (+klen,dlen:key->data) 解析
+#define SCDB_LOAD_BLOCK (1 << 20) // 不能 mmap 的输入按此大小分块读取
+
 struct scdb_hp
 {
-    uint32_t h;
-    uint32_t p;
+    uint64_t h;
+    uint64_t p;
 };
 
 struct scdb_hplist
@@ -42,29 +52,66 @@ struct scdb_hplist
     int num;
 };
 
+// 落盘的一批 (hash, pos): 每个子表在临时文件中的位置与条目数
+struct scdb_run
+{
+    uint64_t off[256];
+    uint64_t cnt[256];
+};
+
 struct scdb_make
 {
     char bspace[8192];
-    char final[2048];
-    uint32_t count[256];
-    uint32_t start[256];
+    char final[SCDB64_HEADER]; // 32 位格式只用前 2048 字节
+    uint64_t count[256];
+    uint64_t start[256];
     struct scdb_hplist *head;
     struct scdb_hp *split; // includes space for hash
     struct scdb_hp *hash;
-    uint32_t numentries;
+    uint64_t numentries;
     buffer b;
-    uint32_t pos;
+    uint64_t pos;
+    uint64_t flags; // SCDB_F_*
+    int fmt;        // SCDB_FMT_32 or SCDB_FMT_64
     int fd;
+    uint64_t inmem;        // 内存中 (hash, pos) 条目数
+    uint64_t memlimit;     // 0 表示不限制
+    char *tmpdir;          // 临时文件目录
+    int spillfd;           // 临时文件, -1 表示未落盘
+    uint64_t spillpos;     // 临时文件写入位置
+    struct scdb_run *runs; // 已落盘的 run, 按时间顺序
+    int nruns;
+    unsigned int filter_bits; // SCDB_F_FILTER: 每个 key 占用的 bit 数
+    unsigned int filter_k;    // 每个 key 设置的 bit 数
+    uint64_t filter_blocks;   // filter 块数
+    uint64_t filter_pos;      // filter 段在文件中的位置
+    char *filter;             // finish 时构建的 filter
+    char *zbuf;               // SCDB_F_ZBLOCK: 正在填充的块 (未压缩)
+    unsigned int zlen;        // zbuf 已用字节数
+    unsigned int zsize;       // 每块的原始字节数
+    int zlevel;               // zlib 压缩级别
+    int zfd;                  // 已压缩的块先写入临时文件, finish 时追加到文件末尾, -1 表示未创建
+    uint64_t zpos;            // 临时文件写入位置, 即下一块在压缩块段内的偏移
+    uint64_t zblock_pos;      // 压缩块段在文件中的位置
+    char *zout;               // 压缩输出缓冲
+    unsigned long zoutcap;
 };
 
 int scdb_make_start(struct scdb_make *c, int fd);
+int scdb_make_start_flags(struct scdb_make *c, int fd, uint64_t flags);
+int scdb_make_set_memlimit(struct scdb_make *c, uint64_t memlimit, char *tmpdir);
+int scdb_make_set_filter(struct scdb_make *c, unsigned int bits_per_key);
+int scdb_make_set_zblock(struct scdb_make *c, unsigned int block_size, int level);
 int scdb_make_addbegin(struct scdb_make *c, unsigned int keylen, unsigned int datalen);
-int scdb_make_addend(struct scdb_make *c, unsigned int keylen, unsigned int datalen, uint32_t h);
+int scdb_make_addend(struct scdb_make *c, unsigned int keylen, unsigned int datalen, uint64_t h);
 int scdb_make_add(struct scdb_make *c,
                   char *key, unsigned int keylen,
                   char *data, unsigned int datalen);
 int scdb_make_finish(struct scdb_make *c);
+int scdb_make_finish_mt(struct scdb_make *c, int nthreads);
 
+int scdb_make_load(struct scdb_make *c, char *fn, char sep);
 int scdb_make_gen_file(char *fn, char sep, char *cdb_fn);
+int scdb_make_gen_file_flags(char *fn, char sep, char *cdb_fn, uint64_t flags);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+/**
+ * scdb 生成性能对比: scdb_make_finish 与 scdb_make_finish_mt
+ *
+ * Build:
+ *  make scdb_make_bench
+ *
+ * Exec:
+ *  ./scdb_make_bench [记录数] [线程数] [32|64] [内存上限 MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "scdb_make.h"
+
+static double now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int build(char *fn, int num, int nthreads, uint64_t flags, uint64_t memlimit,
+                 double *add_sec, double *finish_sec)
+{
+    struct scdb_make c;
+    char key[64], val[128];
+    int i, klen, vlen;
+    double t0, t1, t2;
+
+    int fd = open(fn, O_RDWR | O_TRUNC | O_CREAT, 0644);
+    if (fd == -1)
+        return -1;
+    if (scdb_make_start_flags(&c, fd, flags) == -1)
+        goto FAIL;
+    if (scdb_make_set_memlimit(&c, memlimit, NULL) == -1)
+        goto FAIL;
+
+    t0 = now_sec();
+    for (i = 0; i < num; i++)
+    {
+        klen = snprintf(key, sizeof(key), "user%d@example.com", i);
+        vlen = snprintf(val, sizeof(val), "route=smtp:[10.0.%d.%d]:25", (i >> 8) & 255, i & 255);
+        if (scdb_make_add(&c, key, klen, val, vlen) == -1)
+            goto FAIL;
+    }
+    t1 = now_sec();
+    if (scdb_make_finish_mt(&c, nthreads) == -1)
+        goto FAIL;
+    t2 = now_sec();
+
+    *add_sec = t1 - t0;
+    *finish_sec = t2 - t1;
+
+    close(fd);
+    return 0;
+
+FAIL:
+    close(fd);
+    return -1;
+}
+
+static int same_file(char *a, char *b)
+{
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "cmp -s %s %s", a, b);
+    return system(cmd) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int num = argc > 1 ? atoi(argv[1]) : 2000000;
+    int nthreads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t flags = (argc > 3 && atoi(argv[3]) == 64) ? SCDB_F_64 : 0;
+    uint64_t memlimit = argc > 4 ? strtoull(argv[4], NULL, 10) << 20 : 0;
+    double add1, fin1, addn, finn, addm, finm;
+
+    if (build("scdb_make_bench.1.cdb", num, 1, flags, 0, &add1, &fin1) == -1 ||
+        build("scdb_make_bench.n.cdb", num, nthreads, flags, 0, &addn, &finn) == -1)
+    {
+        fprintf(stderr, "build fail\n");
+        return 1;
+    }
+
+    printf("records: %d, format: %s\n", num, flags ? "64" : "32");
+    printf("add:              %.3fs, %.0f records/s\n", add1, num / add1);
+    printf("finish 1 thread:  %.3fs, %.0f records/s\n", fin1, num / fin1);
+    printf("finish %d threads: %.3fs, %.0f records/s\n", nthreads, finn, num / finn);
+    printf("output identical: %s\n", same_file("scdb_make_bench.1.cdb", "scdb_make_bench.n.cdb") ? "yes" : "NO");
+
+    if (memlimit)
+    {
+        if (build("scdb_make_bench.m.cdb", num, nthreads, flags, memlimit, &addm, &finm) == -1)
+        {
+            fprintf(stderr, "build with memlimit fail\n");
+            return 1;
+        }
+        printf("memlimit %lluMB: add %.3fs, finish %.3fs, %.0f records/s\n",
+               (unsigned long long)(memlimit >> 20), addm, finm, num / (addm + finm));
+        printf("output identical: %s\n", same_file("scdb_make_bench.1.cdb", "scdb_make_bench.m.cdb") ? "yes" : "NO");
+        unlink("scdb_make_bench.m.cdb");
+    }
+
+    unlink("scdb_make_bench.1.cdb");
+    unlink("scdb_make_bench.n.cdb");
+    return 0;
+}
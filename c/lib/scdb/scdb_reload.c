@@ -0,0 +1,233 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include "scdb_reload.h"
+
+static struct scdb_snap *snap_open(char *fn)
+{
+    struct scdb_snap *s;
+    struct stat st;
+
+    s = (struct scdb_snap *)malloc(sizeof(struct scdb_snap));
+    if (!s)
+        return NULL;
+
+    if (scdb_open(&s->db, fn) == -1)
+    {
+        free(s);
+        return NULL;
+    }
+    // 快照供多线程 scdb_lookup, 需要映射; 未映射的块缓存句柄不能共享
+    if (!s->db.map)
+    {
+        scdb_close(&s->db);
+        free(s);
+        return NULL;
+    }
+
+    // 以打开的 fd 为准, 避免 stat 与 open 之间文件再次被替换
+    if (fstat(s->db.fd, &st) == -1)
+    {
+        scdb_close(&s->db);
+        free(s);
+        return NULL;
+    }
+    s->dev = st.st_dev;
+    s->ino = st.st_ino;
+    s->size = st.st_size;
+    s->mtime = st.st_mtim;
+
+    return s;
+}
+
+static void snap_close(struct scdb_snap *s)
+{
+    scdb_close(&s->db);
+    free(s);
+}
+
+/**
+ * @brief   等待替换前进入的读者全部退出
+ * @note 两次翻转 gen, 每次等待旧计数归零: 持有旧快照的读者一定在替换之前计入了某一个计数,
+ *       而翻转之后新进入的读者读到的都是新快照
+ */
+static void synchronize(struct scdb_reload *r)
+{
+    unsigned long gen;
+    int k;
+
+    for (k = 0; k < 2; ++k)
+    {
+        gen = __atomic_load_n(&r->gen, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->gen, gen + 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&r->readers[gen & 1].n, __ATOMIC_SEQ_CST))
+            sched_yield();
+    }
+}
+
+/**
+ * @brief   打开 cdb 文件
+ * @param r         指向 struct scdb_reload 对象的指针
+ * @param cdb_fn    cdb 文件名
+ * @return 0:成功, -1:失败
+ */
+int scdb_reload_open(struct scdb_reload *r, char *cdb_fn)
+{
+    memset(r, 0, sizeof(struct scdb_reload));
+    snprintf(r->fn, sizeof(r->fn), "%s", cdb_fn);
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    r->cur = snap_open(r->fn);
+    if (!r->cur)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * @brief   获取当前快照, 之后可对返回值调用 scdb_lookup/scdb_find_many
+ * @param r     指向 struct scdb_reload 对象的指针
+ * @param idx   输出, 传给 scdb_reload_release()
+ * @return 当前快照, 在 scdb_reload_release() 之前不会被 munmap
+ * @note 不加锁, 只有两次原子操作; 不要在持有快照时调用 scdb_reload_check(), 否则会自己等自己
+ */
+struct scdb *scdb_reload_acquire(struct scdb_reload *r, int *idx)
+{
+    struct scdb_snap *s;
+    int i;
+
+    i = __atomic_load_n(&r->gen, __ATOMIC_SEQ_CST) & 1;
+    __atomic_fetch_add(&r->readers[i].n, 1, __ATOMIC_SEQ_CST);
+    s = __atomic_load_n(&r->cur, __ATOMIC_SEQ_CST);
+
+    *idx = i;
+    return &s->db;
+}
+
+/**
+ * @brief   释放 scdb_reload_acquire() 获取的快照
+ */
+void scdb_reload_release(struct scdb_reload *r, int idx)
+{
+    __atomic_fetch_sub(&r->readers[idx].n, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief   检查文件是否被替换, 是则映射新文件并替换
+ * @param r 指向 struct scdb_reload 对象的指针
+ * @return 1:已重新加载, 0:未变化, -1:失败 (继续使用旧文件)
+ */
+int scdb_reload_check(struct scdb_reload *r)
+{
+    struct scdb_snap *s, *old;
+    struct stat st;
+
+    if (stat(r->fn, &st) == -1)
+        return -1;
+
+    pthread_mutex_lock(&r->lock);
+
+    s = r->cur;
+    if (s->dev == st.st_dev && s->ino == st.st_ino && s->size == st.st_size &&
+        s->mtime.tv_sec == st.st_mtim.tv_sec && s->mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+        pthread_mutex_unlock(&r->lock);
+        return 0;
+    }
+
+    s = snap_open(r->fn);
+    if (!s)
+    {
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+
+    old = __atomic_exchange_n(&r->cur, s, __ATOMIC_SEQ_CST);
+    synchronize(r);
+    snap_close(old);
+
+    pthread_mutex_unlock(&r->lock);
+
+    return 1;
+}
+
+static void *watch_loop(void *arg)
+{
+    struct scdb_reload *r = (struct scdb_reload *)arg;
+    struct timeval now;
+    struct timespec ts;
+
+    pthread_mutex_lock(&r->lock);
+    while (r->watching)
+    {
+        gettimeofday(&now, NULL);
+        ts.tv_sec = now.tv_sec + r->interval_ms / 1000;
+        ts.tv_nsec = now.tv_usec * 1000 + (r->interval_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&r->cond, &r->lock, &ts);
+        if (!r->watching)
+            break;
+
+        pthread_mutex_unlock(&r->lock);
+        scdb_reload_check(r);
+        pthread_mutex_lock(&r->lock);
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief   启动后台线程, 每 interval_ms 毫秒检查一次文件
+ * @return 0:成功, -1:失败
+ */
+int scdb_reload_watch(struct scdb_reload *r, unsigned int interval_ms)
+{
+    if (r->watching)
+        return 0;
+
+    r->interval_ms = interval_ms ? interval_ms : 1000;
+    r->watching = 1;
+    if (pthread_create(&r->watcher, NULL, watch_loop, r) != 0)
+    {
+        r->watching = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   停止后台线程并关闭文件, 调用前所有读者都应已 release
+ */
+void scdb_reload_close(struct scdb_reload *r)
+{
+    if (r->watching)
+    {
+        pthread_mutex_lock(&r->lock);
+        r->watching = 0;
+        pthread_cond_signal(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->watcher, NULL);
+    }
+
+    if (r->cur)
+    {
+        snap_close(r->cur);
+        r->cur = NULL;
+    }
+
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+}
@@ -0,0 +1,67 @@
+/**
+ * 可热替换的 scdb 读取对象, 用于常驻进程
+ *
+ * scdb_make_gen_file() 通过 .tmp + rename() 原子发布新文件, 已经映射旧文件的读者感知不到.
+ * scdb_reload 用 stat 检测文件 (dev, inode, size, mtime) 变化, 映射新文件后原子替换指针,
+ * 等仍在使用旧映射的读者全部退出后再 munmap 旧文件. 读者查找不加锁.
+ *
+ * Usage:
+ *  struct scdb_reload r;
+ *  scdb_reload_open(&r, "route.cdb");
+ *  scdb_reload_watch(&r, 1000);        // 可选, 后台线程每秒检查一次
+ *
+ *  // 任意线程
+ *  int idx;
+ *  struct scdb *db = scdb_reload_acquire(&r, &idx);
+ *  if (scdb_lookup(db, key, keylen, &data, &dlen) == 1)
+ *      ... // data 在 release 之前有效
+ *  scdb_reload_release(&r, idx);
+ *
+ *  scdb_reload_close(&r);
+ */
+
+#ifndef S_CDB_RELOAD_H
+#define S_CDB_RELOAD_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+#include "scdb.h"
+
+struct scdb_snap
+{
+    struct scdb db;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+// 读者计数, 各占一个 cache line, 避免与其它字段伪共享
+struct scdb_readers
+{
+    unsigned long n;
+    char pad[64 - sizeof(unsigned long)];
+};
+
+struct scdb_reload
+{
+    char fn[1024];
+    struct scdb_snap *cur;         // 当前快照, 原子读写
+    unsigned long gen;             // 新读者计入 readers[gen & 1]
+    struct scdb_readers readers[2];
+    pthread_mutex_t lock;          // 串行化 reload
+    pthread_cond_t cond;           // 通知 watcher 退出
+    pthread_t watcher;
+    int watching;
+    unsigned int interval_ms;
+};
+
+int scdb_reload_open(struct scdb_reload *r, char *cdb_fn);
+struct scdb *scdb_reload_acquire(struct scdb_reload *r, int *idx);
+void scdb_reload_release(struct scdb_reload *r, int idx);
+int scdb_reload_check(struct scdb_reload *r);
+int scdb_reload_watch(struct scdb_reload *r, unsigned int interval_ms);
+void scdb_reload_close(struct scdb_reload *r);
+
+#endif
@@ -1,3 +1,4 @@
+#include <string.h>
 #include "utils.h"
 
 /**
@@ -59,6 +60,31 @@ void uint32_unpack_big(char s[4], uint32_t *u)
     *u = result;
 }
 
+/**
+ * @brief   转换 64 位数字到 8 位的字符串 (小端)
+ * @param s 输出, 转换后的字符串
+ * @param u 输入, 需要转换的数字
+ */
+void uint64_pack(char s[8], uint64_t u)
+{
+    uint32_pack(s, (uint32_t)u);
+    uint32_pack(s + 4, (uint32_t)(u >> 32));
+}
+/**
+ * @brief   8位字符转成 64 位数字 (小端)
+ * @param s 输入，需要被转换的8位字符
+ * @param u 输出，转换后的数字
+ */
+void uint64_unpack(char s[8], uint64_t *u)
+{
+    uint32_t lo, hi;
+
+    uint32_unpack(s, &lo);
+    uint32_unpack(s + 4, &hi);
+
+    *u = ((uint64_t)hi << 32) | lo;
+}
+
 uint32_t scdb_hashadd(uint32_t h, unsigned char c)
 {
     h += (h << 5);
@@ -74,4 +100,156 @@ uint32_t scdb_hash(char *buf, unsigned int len)
         --len;
     }
     return h;
+}
+
+// 按小端读取, 保证不同机器上 hash 一致
+static uint64_t load64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint64_t load32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+// 64x64 -> 128 位乘法, 高低两半异或
+static uint64_t mum(uint64_t a, uint64_t b)
+{
+    unsigned __int128 r = (unsigned __int128)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+/**
+ * @brief   64 位 hash (wyhash 风格), 每次处理 16 字节, SCDB_F_HASH64 格式使用
+ * @note 写入文件的格式依赖此函数的输出, 不能修改
+ */
+uint64_t scdb_hash64(char *buf, unsigned int len)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    uint64_t h = 0xa0761d6478bd642fULL ^ len;
+    uint64_t a, b;
+
+    while (len > 16)
+    {
+        h = mum(load64(p) ^ 0xe7037ed1a0b428dbULL, load64(p + 8) ^ h);
+        p += 16;
+        len -= 16;
+    }
+
+    // 剩余 0-16 字节: 首尾各取一段, 可以重叠
+    if (len >= 8)
+    {
+        a = load64(p);
+        b = load64(p + len - 8);
+    }
+    else if (len >= 4)
+    {
+        a = load32(p);
+        b = load32(p + len - 4);
+    }
+    else if (len)
+    {
+        a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        b = 0;
+    }
+    else
+        a = b = 0;
+
+    return scdb_mix64(mum(a ^ 0xe7037ed1a0b428dbULL, b ^ h));
+}
+
+/**
+ * @brief   按文件 flags 选择 key 的 hash: SCDB_F_HASH64 用 scdb_hash64, 否则为 djb hash
+ */
+uint64_t scdb_keyhash(uint64_t flags, char *buf, unsigned int len)
+{
+    if (flags & SCDB_F_HASH64)
+        return scdb_hash64(buf, len);
+    return scdb_hash(buf, len);
+}
+
+/**
+ * @brief   64 位整数混合 (murmur3 fmix64), 让输入的每一位都影响输出
+ */
+uint64_t scdb_mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * @brief   key 的 hash 对应的 filter 块号
+ */
+uint64_t scdb_filter_block(uint64_t nblocks, uint64_t h)
+{
+    return scdb_mix64(h) % nblocks;
+}
+
+/**
+ * @brief   依次取出块内的 k 个 bit 位置, 每个 9 bit (0-511), 用完再混合一次
+ */
+static unsigned int filter_bit(uint64_t *y, unsigned int i)
+{
+    unsigned int bit;
+
+    if (i && (i % 7 == 0))
+        *y = scdb_mix64(*y + i);
+    bit = *y & (SCDB_FILTER_BLOCK * 8 - 1);
+    *y >>= 9;
+    return bit;
+}
+
+/**
+ * @brief   把 hash 加入 filter, 多线程可并发调用
+ * @param filter    filter 段, nblocks * SCDB_FILTER_BLOCK 字节
+ * @param nblocks   块数
+ * @param k         每个 key 设置的 bit 数
+ * @param h         key 的 hash
+ */
+void scdb_filter_add(char *filter, uint64_t nblocks, unsigned int k, uint64_t h)
+{
+    unsigned char *b = (unsigned char *)filter + scdb_filter_block(nblocks, h) * SCDB_FILTER_BLOCK;
+    uint64_t y = scdb_mix64(scdb_mix64(h) ^ h);
+    unsigned int i, bit;
+
+    for (i = 0; i < k; ++i)
+    {
+        bit = filter_bit(&y, i);
+        __atomic_fetch_or(b + (bit >> 3), (unsigned char)(1 << (bit & 7)), __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief   检查 hash 是否可能在 filter 中
+ * @param block 该 hash 对应的 64 字节块
+ * @return 1:可能存在, 0:一定不存在
+ */
+int scdb_filter_test(char *block, unsigned int k, uint64_t h)
+{
+    unsigned char *b = (unsigned char *)block;
+    uint64_t y = scdb_mix64(scdb_mix64(h) ^ h);
+    unsigned int i, bit;
+
+    for (i = 0; i < k; ++i)
+    {
+        bit = filter_bit(&y, i);
+        if (!(b[bit >> 3] & (1 << (bit & 7))))
+            return 0;
+    }
+    return 1;
 }
\ No newline at end of file
@@ -5,13 +5,68 @@
 
 #define SCDB_HASHSTART 5381
 
+// 64 位格式 (cdb64): 文件以 magic 开头, 后跟 flags, 其余为保留字段
+//   [0, 8)       magic "SCDB64\0\1" (最后一字节为版本号)
+//   [8, 16)      flags
+//   [16, 24)     filter 段位置 (SCDB_F_FILTER), 64 字节对齐
+//   [24, 32)     filter 块数, 每块 64 字节
+//   [32, 36)     filter 每个 key 设置的 bit 数 (k)
+//   [36, 40)     保留, 写 0
+//   [40, 48)     压缩块段位置 (SCDB_F_ZBLOCK)
+//   [48, 64)     保留, 写 0
+//   [64, 4160)   256 个 header, 每个 16 字节: 表位置(8) + 槽数(8)
+//   [4160, ...)  记录: klen(4) + dlen(4) + key + data
+//   之后是 256 张 hash 表, 每个槽 16 字节: hash(8) + 记录位置(8)
+//                hash 默认为 djb hash, SCDB_F_HASH64 时为 scdb_hash64 的完整 64 位
+//   之后是可选的 filter 段
+//   之后是可选的压缩块段, 每块: 原始长度(4) + 压缩长度(4) + zlib 数据;
+//   此时记录中的值是 16 字节的引用: 块在段内的偏移(8) + 值在块内的偏移(4) + 值长度(4)
+// 32 位格式与 djb cdb 相同, 没有 magic, 2048 字节 header, 8 字节槽.
+#define SCDB64_MAGIC "SCDB64\0\1"
+#define SCDB64_MAGIC_LEN 8
+#define SCDB64_PREAMBLE 64
+#define SCDB64_HEADER (SCDB64_PREAMBLE + 256 * 16)
+#define SCDB64_OFF_FILTER_POS 16
+#define SCDB64_OFF_FILTER_BLOCKS 24
+#define SCDB64_OFF_FILTER_K 32
+#define SCDB64_OFF_ZBLOCK_POS 40
+
+#define SCDB32_HEADER 2048
+
+#define SCDB_FMT_32 0
+#define SCDB_FMT_64 1
+
+// 写入文件 flags 字段的标志位
+#define SCDB_F_64 0x1     // 使用 64 位格式
+#define SCDB_F_FILTER 0x2 // 带分块 Bloom filter 段, 未命中的查找大多只需读一个 cache line (需要 SCDB_F_64)
+#define SCDB_F_HASH64 0x4 // key 用 scdb_hash64, 槽中保存完整的 64 位 hash 作为标签 (需要 SCDB_F_64)
+#define SCDB_F_ZBLOCK 0x8 // 值按块用 zlib 压缩, 用 scdb_zget 读取 (需要 SCDB_F_64)
+
+// 压缩块
+#define SCDB_ZBLOCK_SIZE 4096  // 默认每块的原始字节数, 更大的值单独成块
+#define SCDB_ZREF 16           // 记录中值引用的长度
+
+// 分块 Bloom filter: 一个 key 的 k 个 bit 全部落在同一个 64 字节块内
+#define SCDB_FILTER_BLOCK 64
+#define SCDB_FILTER_BITS 10 // 默认每个 key 占用的 bit 数, 误判率约 1%
+
 void uint32_pack(char s[4], uint32_t u);
 void uint32_unpack(char s[4], uint32_t *u);
 
 void uint32_pack_big(char s[4], uint32_t u);
 void uint32_unpack_big(char s[4], uint32_t *u);
 
+void uint64_pack(char s[8], uint64_t u);
+void uint64_unpack(char s[8], uint64_t *u);
+
 uint32_t scdb_hashadd(uint32_t h, unsigned char c);
 uint32_t scdb_hash(char *buf, unsigned int len);
+uint64_t scdb_hash64(char *buf, unsigned int len);
+uint64_t scdb_keyhash(uint64_t flags, char *buf, unsigned int len);
+
+uint64_t scdb_mix64(uint64_t x);
+void scdb_filter_add(char *filter, uint64_t nblocks, unsigned int k, uint64_t h);
+int scdb_filter_test(char *block, unsigned int k, uint64_t h);
+uint64_t scdb_filter_block(uint64_t nblocks, uint64_t h);
 
 #endif
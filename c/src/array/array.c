@@ -51,6 +51,87 @@ static char *xstrdup(char *s)
     return t;
 }
 
+/**
+ * @brief   Find the table slot of a key
+ * @param   a       array object to search.
+ * @param   key     Key to look for.
+ * @param   hash    array_hash(key)
+ * @return  Slot number, or -1 if the key is not in the array
+ *
+ * 从 hash & (tsize-1) 开始线性探测, 跳过墓碑, 遇到空槽结束。
+ */
+static int _array_find(array *a, char *key, unsigned hash)
+{
+    unsigned mask = a->tsize - 1;
+    unsigned i;
+    int e;
+
+    for (i = hash & mask; (e = a->table[i].idx) != ARRAY_SLOT_EMPTY; i = (i + 1) & mask)
+    {
+        if (e >= 0 && a->table[i].hash == hash && !strcmp(key, a->item[e].key))
+            return (int)i;
+    }
+    return -1;
+}
+
+/**
+ * @brief   Rebuild the hash table
+ * @param   a       array object to modify.
+ * @param   tsize   New table size, a power of 2 larger than a->n
+ * @return  0 if Ok, -1 if out of memory
+ *
+ * 重建时丢弃所有墓碑。
+ */
+static int _array_rehash(array *a, unsigned int tsize)
+{
+    array_slot *table;
+    unsigned int e;
+    unsigned i;
+
+    table = (array_slot *)malloc(tsize * sizeof(array_slot));
+    if (table == NULL)
+        return -1;
+    for (i = 0; i < tsize; i++)
+        table[i].idx = ARRAY_SLOT_EMPTY;
+
+    for (e = 0; e < a->used; e++)
+    {
+        if (a->item[e].key == NULL)
+            continue;
+        for (i = a->item[e].hash & (tsize - 1); table[i].idx != ARRAY_SLOT_EMPTY; i = (i + 1) & (tsize - 1))
+            ;
+        table[i].hash = a->item[e].hash;
+        table[i].idx = e;
+    }
+    free(a->table);
+    a->table = table;
+    a->tsize = tsize;
+    a->tused = a->n;
+    return 0;
+}
+
+/**
+ * @brief   Close the holes left by deleted entries
+ * @param   a   array object to modify.
+ * @return  0 if Ok, -1 if out of memory
+ *
+ * 成员保持原来的相对顺序, 下标变了, 所以重建哈希表。
+ */
+static int _array_compact(array *a)
+{
+    unsigned int i, j;
+
+    for (i = 0, j = 0; i < a->used; i++)
+    {
+        if (a->item[i].key == NULL)
+            continue;
+        a->item[j++] = a->item[i];
+    }
+    memset(a->item + j, 0, (a->used - j) * sizeof(array_item));
+    a->used = j;
+    return _array_rehash(a, a->tsize);
+}
+
 /**
  * @brief    Create a new array object.
  * @param    size    Optional initial size of the array.
@@ -62,6 +143,7 @@ static char *xstrdup(char *s)
 array *array_new(unsigned int size)
 {
     array *a;
+    unsigned i;
 
     /* If no size was specified, allocate space for ARRAYMINSZ */
     if (size < ARRAYMINSZ)
@@ -71,9 +153,18 @@ array *array_new(unsigned int size)
         return NULL;
 
     a->size = size;
-    a->val = (char **)calloc(size, sizeof(char *));
-    a->key = (char **)calloc(size, sizeof(char *));
-    a->hash = (unsigned int *)calloc(size, sizeof(unsigned));
+    a->item = (array_item *)calloc(size, sizeof(array_item));
+    /* At most half full: table size is a power of 2 >= 2*size */
+    for (a->tsize = 1; a->tsize < 2 * size; a->tsize *= 2)
+        ;
+    a->table = (array_slot *)malloc(a->tsize * sizeof(array_slot));
+    if (a->item == NULL || a->table == NULL)
+    {
+        array_del(a);
+        return NULL;
+    }
+    for (i = 0; i < a->tsize; i++)
+        a->table[i].idx = ARRAY_SLOT_EMPTY;
 
     return a;
 }
@@ -91,16 +182,15 @@ void array_del(array *a)
     if (a == NULL)
         return;
 
-    for (i = 0; i < a->size; i++)
+    for (i = 0; i < a->used; i++)
     {
-        if (a->key[i] != NULL)
-            free(a->key[i]);
-        if (a->val[i] != NULL)
-            free(a->val[i]);
+        if (a->item[i].key != NULL)
+            free(a->item[i].key);
+        if (a->item[i].val != NULL)
+            free(a->item[i].val);
     }
-    free(a->val);
-    free(a->key);
-    free(a->hash);
+    free(a->item);
+    free(a->table);
     free(a);
     return;
 }
@@ -115,24 +205,23 @@ void array_del(array *a)
 int array_clean(array *a)
 {
     int i = 0;
+    unsigned j;
     if (a == NULL)
         return 0;
 
-    for (i = 0; i < a->size; i++)
+    for (i = 0; i < a->used; i++)
     {
-        if (a->key[i] != NULL)
-        {
-            free(a->key[i]);
-            a->key[i] = NULL;
-        }
-        if (a->val[i] != NULL)
-        {
-            free(a->val[i]);
-            a->val[i] = NULL;
-        }
-        a->hash[i] = 0;
+        if (a->item[i].key != NULL)
+            free(a->item[i].key);
+        if (a->item[i].val != NULL)
+            free(a->item[i].val);
     }
+    memset(a->item, 0, a->used * sizeof(array_item));
+    for (j = 0; j < a->tsize; j++)
+        a->table[j].idx = ARRAY_SLOT_EMPTY;
     a->n = 0;
+    a->used = 0;
+    a->tused = 0;
 
     return i;
 }
@@ -178,23 +267,12 @@ unsigned array_hash(char *key)
  */
 char *array_get(array *a, char *key, char *def)
 {
-    unsigned hash;
     int i;
 
-    hash = array_hash(key);
-    for (i = 0; i < a->size; i++)
-    {
-        if (a->key[i] == NULL)
-            continue;
-        /* Compare hash */
-        if (hash == a->hash[i])
-        {
-            /* Compare string, to avoid hash collisions */
-            if (!strcmp(key, a->key[i]))
-                return a->val[i];
-        }
-    }
-    return def;
+    i = _array_find(a, key, array_hash(key));
+    if (i < 0)
+        return def;
+    return a->item[a->table[i].idx].val;
 }
 
 /**
@@ -215,8 +293,11 @@ char *array_get(array *a, char *key, char *def)
  */
 int array_set(array *a, char *key, char *val)
 {
-    int i;
+    array_item *item;
     unsigned hash;
+    unsigned mask;
+    unsigned i;
+    int e;
 
     if (a == NULL || key == NULL)
         return -1;
@@ -225,57 +306,64 @@ int array_set(array *a, char *key, char *val)
     hash = array_hash(key);
 
     /* Find if value is already in array */
-    if (a->n > 0)
+    e = _array_find(a, key, hash);
+    if (e >= 0)
     {
-        for (i = 0; i < a->size; i++)
-        {
-            if (a->key[i] == NULL)
-                continue;
-            if (hash == a->hash[i])
-            {
-                /* Same hash value */
-                if (!strcmp(key, a->key[i]))
-                {
-                    /* Found a value: modify and return */
-                    if (a->val[i] != NULL)
-                        free(a->val[i]);
-                    a->val[i] = val ? xstrdup(val) : NULL;
-                    /* Value has been modified: return */
-                    return 0;
-                }
-            }
-        }
+        /* Found a value: modify and return */
+        item = &a->item[a->table[e].idx];
+        if (item->val != NULL)
+            free(item->val);
+        item->val = val ? xstrdup(val) : NULL;
+        /* Value has been modified: return */
+        return 0;
     }
 
-    /* Add a new value */
+    /* Add a new value at the end */
+    if (a->used == a->size && a->n < a->size / 2)
+    {
+        /* Mostly deleted entries: close the holes */
+        if (_array_compact(a) != 0)
+            return -1;
+    }
     /* See if array needs to grow */
-    if (a->n == a->size)
+    if (a->used == a->size)
     {
         /* Reached maximum size: reallocate array */
-        a->val = (char **)_mem_double(a->val, a->size * sizeof(char *));
-        a->key = (char **)_mem_double(a->key, a->size * sizeof(char *));
-        a->hash = (unsigned int *)_mem_double(a->hash, a->size * sizeof(unsigned));
-        if ((a->val == NULL) || (a->key == NULL) || (a->hash == NULL))
+        item = (array_item *)realloc(a->item, 2 * a->size * sizeof(array_item));
+        if (item == NULL)
             /* Cannot grow array */
             return -1;
+        memset(item + a->size, 0, a->size * sizeof(array_item));
+        a->item = item;
         /* Double size */
         a->size *= 2;
+        if (_array_rehash(a, a->tsize * 2) != 0)
+            return -1;
     }
-
-    /* Insert key in the first empty slot */
-    for (i = 0; i < a->size; i++)
+    else if (a->tused >= a->tsize / 4 * 3)
     {
-        if (a->key[i] == NULL)
-            /* Add key here */
-            break;
+        /* Too many tombstones */
+        if (_array_rehash(a, a->tsize) != 0)
+            return -1;
     }
 
     /* Copy key */
-    a->key[i] = xstrdup(key);
-    a->val[i] = val ? xstrdup(val) : NULL;
-    a->hash[i] = hash;
+    e = a->used;
+    a->item[e].key = xstrdup(key);
+    a->item[e].val = val ? xstrdup(val) : NULL;
+    a->item[e].hash = hash;
+    a->used++;
     a->n++;
 
+    /* First free slot, a tombstone can be reused */
+    mask = a->tsize - 1;
+    for (i = hash & mask; a->table[i].idx >= 0; i = (i + 1) & mask)
+        ;
+    if (a->table[i].idx == ARRAY_SLOT_EMPTY)
+        a->tused++;
+    a->table[i].hash = hash;
+    a->table[i].idx = e;
+
     return 0;
 }
 
@@ -289,40 +377,33 @@ int array_set(array *a, char *key, char *val)
  */
 void array_unset(array *a, char *key)
 {
-    unsigned hash;
+    array_item *item;
     int i;
 
     if (key == NULL)
         return;
 
-    hash = array_hash(key);
-    for (i = 0; i < a->size; i++)
-    {
-        if (a->key[i] == NULL)
-            continue;
-        /* Compare hash */
-        if (hash == a->hash[i])
-        {
-            /* Compare string, to avoid hash collisions */
-            if (!strcmp(key, a->key[i]))
-                /* Found key */
-                break;
-        }
-    }
-    if (i >= a->size)
+    i = _array_find(a, key, array_hash(key));
+    if (i < 0)
         /* Key not found */
         return;
 
-    free(a->key[i]);
-    a->key[i] = NULL;
-    if (a->val[i] != NULL)
+    item = &a->item[a->table[i].idx];
+    a->table[i].idx = ARRAY_SLOT_DELETED;
+    free(item->key);
+    item->key = NULL;
+    if (item->val != NULL)
     {
-        free(a->val[i]);
-        a->val[i] = NULL;
+        free(item->val);
+        item->val = NULL;
     }
-    a->hash[i] = 0;
+    item->hash = 0;
     a->n--;
 
+    /* Deleted entries at the end are free again */
+    while (a->used > 0 && a->item[a->used - 1].key == NULL)
+        a->used--;
+
     return;
 }
 
@@ -341,14 +422,15 @@ unsigned int array_size(array *a)
     return a->size;
 }
 
+/* Entries 0..array_size()-1 in insertion order, NULL for deleted and unused ones */
 char *array_key(array *a, unsigned int i)
 {
-    return a->key[i];
+    return a->item[i].key;
 }
 
 char *array_value(array *a, unsigned int i)
 {
-    return a->val[i];
+    return a->item[i].val;
 }
 
 /**
@@ -375,24 +457,24 @@ char *array_implode_alloc(char *sep, array *a)
     if (res == NULL)
         return NULL;
 
-    for (i = 0; i < a->size; i++)
+    for (i = 0; i < a->used; i++)
     {
-        if (a->key[i] && (a->val[i] != NULL))
+        if (a->item[i].key && (a->item[i].val != NULL))
         {
             if (i == 0)
             {
-                snprintf(res, size, "%s", a->val[i]);
+                snprintf(res, size, "%s", a->item[i].val);
             }
             else
             {
-                if ((size - len) <= (strlen(sep) + strlen(a->val[i])))
+                if ((size - len) <= (strlen(sep) + strlen(a->item[i].val)))
                 {
                     res = _mem_double(res, size);
                     if (res == NULL)
                         return NULL;
                     size *= 2;
                 }
-                snprintf(res + len, size - len, "%s%s", sep, a->val[i]);
+                snprintf(res + len, size - len, "%s%s", sep, a->item[i].val);
             }
 
             len = strlen(res);
@@ -455,13 +537,13 @@ void array_dump(array *a, FILE *out)
         return;
 
     fprintf(out, "array(%d,<%d>) {\n", a->n, a->size);
-    for (i = 0; i < a->size; i++)
+    for (i = 0; i < a->used; i++)
     {
-        if (a->key[i])
+        if (a->item[i].key)
         {
             fprintf(out, "  [\"%s\"] => \"%s\"\n",
-                    a->key[i],
-                    a->val[i] ? a->val[i] : "UNDEF");
+                    a->item[i].key,
+                    a->item[i].val ? a->item[i].val : "UNDEF");
         }
     }
     fprintf(out, "}\n");
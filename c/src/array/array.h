@@ -2,22 +2,47 @@
 #define _S_ARRAY_H
 #include <stdio.h>
 
+/**
+ * @brief 数组成员, hash/key/value 放在一起, 查找命中后只需访问一次
+ */
+typedef struct array_item
+{
+    unsigned hash; /* Hash value of key */
+    char *key;     /* String key, NULL if deleted */
+    char *val;     /* String value */
+} array_item;
+
+/**
+ * @brief 哈希表槽位: 成员下标和 hash, 冲突时不必访问成员
+ */
+typedef struct array_slot
+{
+    unsigned hash;
+    int idx; /* Entry number, ARRAY_SLOT_EMPTY or ARRAY_SLOT_DELETED */
+} array_slot;
+
 /**
  * @brief 数组对象
  * 
  * 该对象包含一个字符串/字符串关联的列表。每一个
- * 关联由唯一的字符串键标识。查找值
- * 在字典中通过使用一个(希望没有碰撞)来加速哈希函数。
+ * 关联由唯一的字符串键标识。
+ * 成员按插入顺序存放在 item 中 (删除的成员 key 为 NULL), array_key/array_value
+ * 按下标遍历得到插入顺序; 查找通过开放寻址 (线性探测) 的哈希表 table, 平均 O(1)。
  */
 typedef struct array
 {
-    unsigned int n;    /* Number of entries in dictionary */
-    unsigned int size; /* Storage size */
-    char **val;        /* List of string values */
-    char **key;        /* List of string keys */
-    unsigned *hash;    /* List of hash values for keys */
+    unsigned int n;     /* Number of entries in array */
+    unsigned int size;  /* Storage size */
+    unsigned int used;  /* Entries used in item, deleted ones included */
+    array_item *item;   /* Entries in insertion order */
+    array_slot *table;  /* Hash table of entry numbers */
+    unsigned int tsize; /* Table size, a power of 2 */
+    unsigned int tused; /* Table slots used, tombstones included */
 } array;
 
+#define ARRAY_SLOT_EMPTY -1
+#define ARRAY_SLOT_DELETED -2
+
 /* Invalid key token */
 #define ARRAY_INVALID_KEY ((char *)-1)
 
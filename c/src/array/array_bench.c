@@ -0,0 +1,150 @@
+/**
+ * array 微基准: 每个请求一个 header map 的用法, 以及不同规模下的
+ * array_set / array_get (命中, 未命中) / 遍历 / array_unset
+ *
+ * Build:
+ *  gcc -O2 -o array_bench array_bench.c array.c
+ *
+ * Exec:
+ *  ./array_bench [keys ...]     默认 16 1000 10000
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "array.h"
+
+#define HEADERS 20
+#define REQUESTS 100000
+
+static const char *headers[HEADERS] = {
+    "Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding",
+    "Connection", "Cookie", "Referer", "Cache-Control", "Content-Type",
+    "Content-Length", "Authorization", "Origin", "Pragma", "Upgrade-Insecure-Requests",
+    "If-Modified-Since", "If-None-Match", "X-Forwarded-For", "X-Real-IP", "X-Request-Id"};
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, int keys, long ops, double t)
+{
+    printf("%-12s %8d keys: %8.3f ms, %6.1f ns/op\n", name, keys, t * 1000, t * 1e9 / ops);
+}
+
+/* 每个请求: new, 设置 20 个 header, 查 5 个存在的和 5 个不存在的, del */
+static int bench_headers(void)
+{
+    array *a;
+    double t0, t;
+    int r, i, miss = 0;
+
+    t0 = now_sec();
+    for (r = 0; r < REQUESTS; r++)
+    {
+        a = array_new(0);
+        if (a == NULL)
+            return -1;
+        for (i = 0; i < HEADERS; i++)
+            array_set(a, (char *)headers[i], "value");
+        for (i = 0; i < 5; i++)
+        {
+            if (array_get(a, (char *)headers[i * 3], NULL) == NULL)
+                miss++;
+            if (array_get(a, "X-Not-There", NULL) != NULL)
+                miss++;
+        }
+        array_del(a);
+    }
+    t = now_sec() - t0;
+    printf("%-12s %8d reqs: %8.3f ms, %6.1f ns/req\n", "headers", REQUESTS, t * 1000, t * 1e9 / REQUESTS);
+
+    return miss ? -1 : 0;
+}
+
+static int bench(int keys)
+{
+    array *a;
+    char key[64];
+    double t0;
+    long sum = 0;
+    int i, miss = 0;
+
+    a = array_new(0);
+    if (a == NULL)
+        return -1;
+
+    t0 = now_sec();
+    for (i = 0; i < keys; i++)
+    {
+        snprintf(key, sizeof(key), "key-%d", i);
+        array_set(a, key, key);
+    }
+    report("set", keys, keys, now_sec() - t0);
+
+    t0 = now_sec();
+    for (i = 0; i < keys; i++)
+    {
+        snprintf(key, sizeof(key), "key-%d", i);
+        if (array_get(a, key, NULL) == NULL)
+            miss++;
+    }
+    report("get hit", keys, keys, now_sec() - t0);
+
+    t0 = now_sec();
+    for (i = 0; i < keys; i++)
+    {
+        snprintf(key, sizeof(key), "nokey-%d", i);
+        if (array_get(a, key, NULL) != NULL)
+            miss++;
+    }
+    report("get miss", keys, keys, now_sec() - t0);
+
+    t0 = now_sec();
+    for (i = 0; i < array_size(a); i++)
+    {
+        if (array_key(a, i))
+            sum += strlen(array_value(a, i));
+    }
+    report("iterate", keys, keys, now_sec() - t0);
+
+    t0 = now_sec();
+    for (i = 0; i < keys; i++)
+    {
+        snprintf(key, sizeof(key), "key-%d", i);
+        array_unset(a, key);
+    }
+    report("unset", keys, keys, now_sec() - t0);
+
+    if (array_count(a) != 0 || sum == 0)
+        miss++;
+    array_del(a);
+
+    return miss ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int sizes[] = {16, 1000, 10000};
+    int i;
+
+    if (bench_headers() != 0)
+        return 1;
+
+    if (argc > 1)
+    {
+        for (i = 1; i < argc; i++)
+            if (bench(atoi(argv[i])) != 0)
+                return 1;
+        return 0;
+    }
+    for (i = 0; i < 3; i++)
+        if (bench(sizes[i]) != 0)
+            return 1;
+
+    return 0;
+}
@@ -57,11 +57,11 @@ int main(int argc, char **argv)
 
     char *str2 = "May 11 14:03:32 10.75.30.234 spam_filter[39641]: log_headers";
     array *s_list = array_explode_alloc(" ", str2);
-    for (i = 0; i < s_list->size; i++)
+    for (i = 0; i < array_size(s_list); i++)
     {
-        if (s_list->key[i])
+        if (array_key(s_list, i))
         {
-            slog_info("[%d]: %s", i, s_list->val[i]);
+            slog_info("[%d]: %s", i, array_value(s_list, i));
         }
     }
     slog_info("deallocate s_list");